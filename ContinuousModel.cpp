@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include "ContinuousModel.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+
+ContinuousModel::ContinuousModel(const string& filename)
+{
+	ifstream file(filename);
+	if (!file.is_open())
+		throw runtime_error("file not found: " + string(filename));
+
+	string line;
+	getline(file, line);
+	vector<int> header = split<int>(line);
+	if (header.size() != 3 || header[0] <= 0 || header[1] <= 0)
+		throw runtime_error("expected \"N D T\" on the first line of " + filename);
+
+	size_t N = header[0], D = header[1];
+	_numOfTimeSteps = header[2];
+
+	getline(file, line);
+	_stateNames = split<string>(line);
+	if (_stateNames.size() != N)
+		throw runtime_error("expected " + to_string(N) + " state names in " + filename);
+
+	// consume "a:"
+	getline(file, line);
+	for (size_t i = 0; i < N; ++i)
+	{
+		getline(file, line);
+		vector<double> row = split<double>(line);
+		if (row.size() != N)
+			throw runtime_error("a: rows need " + to_string(N) + " entries in " + filename);
+
+		_transitions.insert(_transitions.end(), row.begin(), row.end());
+	}
+
+	/* The tag line names the family of densities. */
+	getline(file, line);
+	vector<string> tag = split<string>(line);
+	_emissions = readEmissionModel(file, tag.empty() ? "" : tag[0], N, D);
+
+	// consume "pi:"
+	getline(file, line);
+	getline(file, line);
+	_initStates = split<double>(line);
+	if (!file || _initStates.size() != N)
+		throw runtime_error("pi: needs " + to_string(N) + " entries in " + filename);
+}
+
+
+/* Fill b (T x N) with the densities of every frame divided by their largest one, and return
+ * the sum of the logs of those maxima, or -infinity if some frame has zero density for all
+ * states. */
+double ContinuousModel::emissionColumns(const FeatureSequence& obs, vector<double>& b) const
+{
+	size_t N = numStates(), T = obs.length();
+
+	vector<double> logb;
+	_emissions->logDensities(obs, logb);
+	b.resize(T*N);
+
+	double shift = 0;
+	for (size_t t = 0; t < T; ++t)
+	{
+		const double* column = &logb[t*N];
+		double peak = *max_element(column, column + N);
+		if (peak == -numeric_limits<double>::infinity())
+			return -numeric_limits<double>::infinity();
+
+		for (size_t i = 0; i < N; ++i)
+			b[t*N + i] = exp(column[i] - peak);
+		shift += peak;
+	}
+	return shift;
+}
+
+
+/* out = (prev A) .* b, rescaled to sum at one; prev is NULL for the first column. Returns the
+ * scale. */
+double ContinuousModel::forwardStep(const double* prev, const double* b, double* out) const
+{
+	size_t N = numStates();
+
+	if (prev)
+	{
+		fill(out, out + N, 0.0);
+		for (size_t i = 0; i < N; ++i)
+		{
+			const double* row = &_transitions[i*N];
+			for (size_t j = 0; j < N; ++j)
+				out[j] += prev[i] * row[j];
+		}
+	}
+	else
+		copy(_initStates.begin(), _initStates.end(), out);
+
+	double scale = 0;
+	for (size_t j = 0; j < N; ++j)
+	{
+		out[j] *= b[j];
+		scale += out[j];
+	}
+
+	if (scale > 0)
+		for (size_t j = 0; j < N; ++j)
+			out[j] /= scale;
+
+	return scale;
+}
+
+
+double ContinuousModel::logLikelihood(const FeatureSequence& obs) const
+{
+	size_t N = numStates(), T = obs.length();
+	if (T == 0)
+		return 0;
+
+	vector<double> b;
+	double logProb = emissionColumns(obs, b);
+	if (std::isinf(logProb))
+		return logProb;
+
+	vector<double> ring(2*N);
+	const double* prev = NULL;
+
+	for (size_t t = 0; t < T; ++t)
+	{
+		double* cur = &ring[(t % 2)*N];
+
+		double scale = forwardStep(prev, &b[t*N], cur);
+		if (scale <= 0)
+			return -numeric_limits<double>::infinity();
+
+		logProb += log(scale);
+		prev = cur;
+	}
+
+	return logProb;
+}
+
+
+pair<double, vector<int> > ContinuousModel::viterbi(const FeatureSequence& obs) const
+{
+	size_t N = numStates(), T = obs.length();
+	if (T == 0)
+		return make_pair(0.0, vector<int>());
+
+	vector<double> b;
+	double logProb = emissionColumns(obs, b);
+	if (std::isinf(logProb))
+		return make_pair(logProb, vector<int>());
+
+	vector<double> delta(N), next(N);
+	vector<int> backPointers(T*N);
+
+	for (size_t t = 0; t < T; ++t)
+	{
+		const double* bt = &b[t*N];
+
+		for (size_t j = 0; j < N; ++j)
+		{
+			if (t == 0)
+			{
+				next[j] = _initStates[j] * bt[j];
+				continue;
+			}
+
+			double best = -1;
+			int from = 0;
+			for (size_t i = 0; i < N; ++i)
+			{
+				double v = delta[i] * _transitions[i*N + j];
+				if (v > best)
+				{
+					best = v;
+					from = i;
+				}
+			}
+
+			next[j] = best * bt[j];
+			backPointers[t*N + j] = from;
+		}
+
+		/* Rescale to peak at one. */
+		double peak = *max_element(next.begin(), next.end());
+		if (peak <= 0)
+			return make_pair(-numeric_limits<double>::infinity(), vector<int>());
+
+		for (size_t j = 0; j < N; ++j)
+			delta[j] = next[j] / peak;
+		logProb += log(peak);
+	}
+
+	vector<int> path(T);
+	path[T-1] = max_element(delta.begin(), delta.end()) - delta.begin();
+	for (size_t t = T-1; t > 0; --t)
+		path[t-1] = backPointers[t*N + path[t]];
+
+	return make_pair(logProb, path);
+}
+
+
+/* Scaled forward-backward as in DenseModel::accumulate(), keeping the whole trellis. */
+double ContinuousModel::accumulate(const FeatureSequence& obs, ExpectedCounts& counts)
+{
+	size_t N = numStates(), T = obs.length();
+	if (T == 0)
+		return 0;
+
+	vector<double> b;
+	double logProb = emissionColumns(obs, b);
+	if (std::isinf(logProb))
+		return logProb;
+
+	vector<double> alpha(T*N), scales(T);
+	for (size_t t = 0; t < T; ++t)
+	{
+		scales[t] = forwardStep(t ? &alpha[(t-1)*N] : NULL, &b[t*N], &alpha[t*N]);
+		if (scales[t] <= 0)
+			return -numeric_limits<double>::infinity();
+
+		logProb += log(scales[t]);
+	}
+
+	/* gamma_t = alpha_t .* beta_t; alpha is overwritten by gamma as beta sweeps back. */
+	vector<double> beta(N, 1.0), weighted(N);
+
+	for (size_t t = T; t-- > 0; )
+	{
+		if (t < T-1)
+		{
+			/* weighted(j) = b_j(x_t+1) * beta_t+1(j) / c_t+1, shared by xi_t and beta_t. */
+			for (size_t j = 0; j < N; ++j)
+				weighted[j] = b[(t+1)*N + j] * beta[j] / scales[t+1];
+
+			for (size_t i = 0; i < N; ++i)
+			{
+				const double* row = &_transitions[i*N];
+				double* xi = &counts.transitions[i*N];
+				double sum = 0;
+
+				for (size_t j = 0; j < N; ++j)
+				{
+					double w = row[j] * weighted[j];
+					sum += w;
+					xi[j] += alpha[t*N + i] * w;
+				}
+				beta[i] = sum;
+			}
+		}
+
+		for (size_t i = 0; i < N; ++i)
+			alpha[t*N + i] *= beta[i];
+	}
+
+	for (size_t i = 0; i < N; ++i)
+		counts.initStates[i] += alpha[i];
+
+	_emissions->accumulate(obs, alpha);
+
+	++counts.sequences;
+	counts.logLikelihood += logProb;
+	return logProb;
+}
+
+
+void ContinuousModel::reestimate(const ExpectedCounts& counts)
+{
+	size_t N = numStates();
+	if (counts.numStates != N)
+		throw runtime_error("expected counts do not match the model");
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		double sum = 0;
+		for (size_t j = 0; j < N; ++j)
+			sum += counts.transitions[i*N + j];
+		if (sum > 0)
+			for (size_t j = 0; j < N; ++j)
+				_transitions[i*N + j] = counts.transitions[i*N + j] / sum;
+	}
+
+	if (counts.sequences > 0)
+		for (size_t i = 0; i < N; ++i)
+			_initStates[i] = counts.initStates[i] / counts.sequences;
+
+	_emissions->reestimate();
+}
+
+
+void ContinuousModel::save(const string& filename) const
+{
+	ofstream file(filename);
+	if (!file.is_open())
+		throw runtime_error("cannot create file: " + filename);
+
+	/* Enough digits for every parameter to read back as the same double. */
+	file.precision(numeric_limits<double>::max_digits10);
+
+	size_t N = numStates();
+	file << N << " " << dimension() << " " << _numOfTimeSteps << endl;
+
+	/* Write state names. */
+	for (auto stt : _stateNames)
+		file << stt << " ";
+	file << endl;
+
+	/* Write transition matrix. */
+	file << "a:" << endl;
+	for (size_t i = 0; i < N; ++i)
+	{
+		for (size_t j = 0; j < N; ++j)
+			file << _transitions[i*N + j] << " ";
+		file << endl;
+	}
+
+	/* Write emission densities. */
+	_emissions->write(file);
+
+	/* Write initial state matrix. */
+	file << "pi:" << endl;
+	for (size_t i = 0; i < N; ++i)
+		file << _initStates[i] << " ";
+	file << endl;
+}
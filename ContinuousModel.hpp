@@ -0,0 +1,80 @@
+#ifndef GUARD_CONTINUOUS_MODEL_HPP
+#define GUARD_CONTINUOUS_MODEL_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "EmissionModel.hpp"
+#include "ExpectedCounts.hpp"
+
+
+/**
+ * HMM over feature vectors, with the state densities given by an EmissionModel. The .hmm file
+ * has the first line "N D T" with the feature dimension D in place of the number of outputs, no
+ * line of output names, and an emission block such as "gmm:" in place of "b:":
+ *
+ *     N D T
+ *     state names
+ *     a:
+ *     N lines of N probabilities
+ *     gmm:
+ *     ...
+ *     pi:
+ *     N probabilities
+ *
+ * Every pass first scores all frames for all states, then shifts each frame's log-densities by
+ * their maximum before leaving the log domain, so densities far from one cannot over- or
+ * underflow the scaled trellis.
+ */
+class ContinuousModel
+{
+public:
+	ContinuousModel(const std::string& filename);
+
+	size_t numStates() const { return _stateNames.size(); }
+	size_t dimension() const { return _emissions->dimension(); }
+	const std::vector<std::string>& states() const { return _stateNames; }
+	const EmissionModel& emissions() const { return *_emissions; }
+
+	/**
+	 * Returns log p(obs | model), or -infinity if the sequence cannot be produced.
+	 */
+	double logLikelihood(const FeatureSequence& obs) const;
+	/**
+	 * Returns the log-density of the most likely state path and the path itself. The path is
+	 * empty if no path can produce the sequence.
+	 */
+	std::pair<double, std::vector<int> > viterbi(const FeatureSequence& obs) const;
+
+	/**
+	 * Baum-Welch E-step: add the transition and initial state counts of a single sequence to
+	 * counts, which need no emission counts (M = 0), and the emission statistics to the
+	 * emission model. Returns the log-likelihood of the sequence.
+	 */
+	double accumulate(const FeatureSequence& obs, ExpectedCounts& counts);
+	/**
+	 * Baum-Welch M-step: re-estimate A and pi from counts, and the emission model from its own
+	 * statistics.
+	 */
+	void reestimate(const ExpectedCounts& counts);
+
+	/**
+	 * Write this model as an .hmm file.
+	 */
+	void save(const std::string& filename) const;
+
+private:
+	double emissionColumns(const FeatureSequence& obs, std::vector<double>& b) const;
+	double forwardStep(const double* prev, const double* b, double* out) const;
+
+private:
+	size_t _numOfTimeSteps;
+	std::vector<std::string> _stateNames;
+
+	std::vector<double> _transitions;	// N x N
+	std::vector<double> _initStates;	// N
+	std::unique_ptr<EmissionModel> _emissions;
+};
+
+
+#endif
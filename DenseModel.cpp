@@ -0,0 +1,1404 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "DenseModel.hpp"
+#include "HiddenMarkovModel.hpp"
+
+using namespace std;
+
+
+Precision parsePrecision(const string& name)
+{
+	if (name == "double")
+		return Precision::Double;
+	if (name == "float" || name == "single")
+		return Precision::Single;
+	if (name == "mixed")
+		return Precision::Mixed;
+
+	throw runtime_error("unknown precision: " + name);
+}
+
+
+template <typename Real, typename Accum>
+DenseModel<Real, Accum>::DenseModel(HiddenMarkovModel& hmm)
+	: _numOfTimeSteps(hmm.timeSteps()), _memoryBudget(0),
+	  _stateNames(hmm.states()), _outputNames(hmm.outputs()), _replicaMutex(new mutex)
+{
+	size_t N = numStates(), M = numOutputs();
+
+	for (size_t o = 0; o < M; ++o)
+		_outputIndex[_outputNames[o]] = o;
+
+	_transitions.resize(N*N);
+	_emissions.resize(N*M);
+	_initStates.resize(N);
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		for (size_t j = 0; j < N; ++j)
+			_transitions[i*N + j] = hmm.transition(_stateNames[i], _stateNames[j]);
+
+		for (size_t o = 0; o < M; ++o)
+			_emissions[i*M + o] = hmm.emission(_stateNames[i], _outputNames[o]);
+
+		_initStates[i] = hmm.initState(_stateNames[i]);
+	}
+
+	prepareEmissions();
+}
+
+
+template <typename Real, typename Accum>
+DenseModel<Real, Accum>::DenseModel(const vector<string>& states, const vector<string>& outputs,
+									const vector<double>& transitions,
+									const vector<double>& emissions,
+									const vector<double>& initStates, size_t timeSteps)
+	: _numOfTimeSteps(timeSteps), _memoryBudget(0), _stateNames(states), _outputNames(outputs),
+	  _transitions(transitions.begin(), transitions.end()),
+	  _emissions(emissions.begin(), emissions.end()),
+	  _initStates(initStates.begin(), initStates.end()), _replicaMutex(new mutex)
+{
+	size_t N = numStates(), M = numOutputs();
+	if (_transitions.size() != N*N || _emissions.size() != N*M || _initStates.size() != N)
+		throw runtime_error("model matrices do not match the number of states and outputs");
+
+	for (size_t o = 0; o < M; ++o)
+		_outputIndex[_outputNames[o]] = o;
+
+	prepareEmissions();
+}
+
+
+template <typename Real, typename Accum>
+vector<int> DenseModel<Real, Accum>::encode(const vector<string>& obs) const
+{
+	vector<int> ret;
+	ret.reserve(obs.size());
+
+	for (auto out : obs)
+	{
+		auto it = _outputIndex.find(out);
+		if (it == _outputIndex.end())
+			throw runtime_error("No such output: " + out);
+
+		ret.push_back(it->second);
+	}
+	return ret;
+}
+
+
+template <typename Real, typename Accum>
+double DenseModel<Real, Accum>::logLikelihood(const vector<string>& obs) const
+{
+	return logLikelihood(encode(obs));
+}
+
+template <typename Real, typename Accum>
+double DenseModel<Real, Accum>::logLikelihood(const vector<int>& obs) const
+{
+	unsigned threads = thread::hardware_concurrency();
+
+	if (useParallelScan(obs.size(), threads))
+		return parallelLogLikelihood(obs, threads);
+	return sequentialLogLikelihood(obs);
+}
+
+/* Scaled forward algorithm (Rabiner, section V.A): each alpha column is normalized to sum to one
+ * and log P(O) is the sum of the logs of the normalizers. */
+template <typename Real, typename Accum>
+double DenseModel<Real, Accum>::sequentialLogLikelihood(const vector<int>& obs) const
+{
+	size_t N = numStates();
+	vector<Real> alpha(N), next(N);
+	vector<Accum> scratch(N);
+	Accum logProb = 0;
+
+	for (size_t t = 0; t < obs.size(); ++t)
+	{
+		Accum scale = forwardStep(obs, t, alpha.data(), next.data(), scratch);
+		if (scale <= 0)
+			return -numeric_limits<double>::infinity();
+
+		logProb += log(scale);
+		alpha.swap(next);
+	}
+
+	return logProb;
+}
+
+
+/* Compute the alpha column at time t from the one at t-1 (prev, unused when t == 0) into out,
+ * normalized to sum to one. Returns the normalizer c_t, which is zero if the column vanishes. */
+template <typename Real, typename Accum>
+Accum DenseModel<Real, Accum>::forwardStep(const vector<int>& obs, size_t t, const Real* prev,
+										   Real* out, vector<Accum>& next) const
+{
+	size_t N = numStates();
+
+	const Real* b = emissionColumn(obs[t]);
+
+	if (t == 0)
+	{
+		for (size_t j = 0; j < N; ++j)
+			next[j] = Accum(_initStates[j]) * b[j];
+	}
+	else
+	{
+		fill(next.begin(), next.end(), Accum(0));
+
+		/* A fused output's matrix already carries b(o_t). */
+		const Real* fused = fusedTransitions(obs[t]);
+		const Real* A = fused ? fused : _transitions.data();
+
+		/* Walk A row by row so the inner loop reads it contiguously. */
+		for (size_t i = 0; i < N; ++i)
+		{
+			const Real a_i = prev[i];
+			if (a_i == 0)
+				continue;
+
+			const Real* row = &A[i*N];
+			for (size_t j = 0; j < N; ++j)
+				next[j] += Accum(a_i) * row[j];
+		}
+
+		if (!fused)
+			for (size_t j = 0; j < N; ++j)
+				next[j] *= b[j];
+	}
+
+	Accum scale = 0;
+	for (size_t j = 0; j < N; ++j)
+		scale += next[j];
+
+	if (scale > 0)
+		for (size_t j = 0; j < N; ++j)
+			out[j] = Real(next[j] / scale);
+
+	return scale;
+}
+
+
+template <typename Real, typename Accum>
+pair<double, vector<string> > DenseModel<Real, Accum>::viterbi(const vector<string>& obs) const
+{
+	pair<double, vector<int> > best = viterbi(encode(obs));
+
+	vector<string> path;
+	for (auto stt : best.second)
+		path.push_back(_stateNames[stt]);
+
+	return make_pair(best.first, path);
+}
+
+template <typename Real, typename Accum>
+pair<double, vector<int> > DenseModel<Real, Accum>::viterbi(const vector<int>& obs) const
+{
+	unsigned threads = thread::hardware_concurrency();
+
+	if (useParallelScan(obs.size(), threads))
+		return parallelViterbi(obs, threads);
+	return sequentialViterbi(obs);
+}
+
+/* Max-product Viterbi where every delta column is rescaled so its largest entry is one. */
+template <typename Real, typename Accum>
+pair<double, vector<int> > DenseModel<Real, Accum>::sequentialViterbi(const vector<int>& obs) const
+{
+	if (obs.empty())
+		return make_pair(0.0, vector<int>());
+
+	size_t N = numStates(), T = obs.size();
+	vector<Real> delta(N), next(N);
+	vector<int> backPtr(T*N);
+	Accum logProb = 0;
+	int bestStt = 0;
+
+	for (size_t t = 0; t < T; ++t)
+	{
+		const Real* b = emissionColumn(obs[t]);
+
+		if (t == 0)
+		{
+			for (size_t j = 0; j < N; ++j)
+				next[j] = _initStates[j] * b[j];
+		}
+		else
+		{
+			fill(next.begin(), next.end(), Real(0));
+			int* ptr = &backPtr[t*N];
+
+			const Real* fused = fusedTransitions(obs[t]);
+			const Real* A = fused ? fused : _transitions.data();
+
+			for (size_t i = 0; i < N; ++i)
+			{
+				const Real d_i = delta[i];
+				if (d_i == 0)
+					continue;
+
+				const Real* row = &A[i*N];
+				for (size_t j = 0; j < N; ++j)
+				{
+					Real curr = d_i * row[j];
+					if (curr > next[j])
+					{
+						next[j] = curr;
+						ptr[j] = i;
+					}
+				}
+			}
+
+			if (!fused)
+				for (size_t j = 0; j < N; ++j)
+					next[j] *= b[j];
+		}
+
+		Real scale = 0;
+		for (size_t j = 0; j < N; ++j)
+			if (next[j] > scale)
+			{
+				scale = next[j];
+				bestStt = j;
+			}
+
+		/* Probability is zero; no such path can be built. */
+		if (scale <= 0)
+			return make_pair(-numeric_limits<double>::infinity(), vector<int>());
+
+		for (size_t j = 0; j < N; ++j)
+			delta[j] = next[j] / scale;
+
+		logProb += log(Accum(scale));
+	}
+
+	/* Follow the back pointers from the peak of the final column. */
+	vector<int> path(T);
+	path[T-1] = bestStt;
+
+	for (size_t t = T-1; t > 0; --t)
+		path[t-1] = backPtr[t*N + path[t]];
+
+	return make_pair(double(logProb), path);
+}
+
+
+/* Below this many time steps, starting threads costs more than the scan can save. */
+static const size_t MIN_PARALLEL_STEPS = 1 << 14;
+
+/* Each chunk does N times the work of the sequential pass (matrix instead of vector products), so
+ * the scan pays off only with clearly more threads than states. */
+template <typename Real, typename Accum>
+bool DenseModel<Real, Accum>::useParallelScan(size_t T, unsigned threads) const
+{
+	return T >= MIN_PARALLEL_STEPS && threads >= 2*numStates() + 2;
+}
+
+
+/* Multiply P (N x N) in place by the step matrices A * diag(b(o_t)) for t in [begin, end), in the
+ * sum-product or max-product semiring. Every row of P is rescaled to peak at one after every step,
+ * and the log of its total rescaling is kept in rowScales, or -infinity, with the row all zero,
+ * once no path from its state crosses the chunk. The rows are scaled apart because the paths from
+ * different entry states may differ by far more than the range of Accum. */
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::chunkProduct(const vector<int>& obs, size_t begin, size_t end,
+										   bool maxProduct, vector<Accum>& P,
+										   vector<Accum>& rowScales) const
+{
+	size_t N = numStates();
+	vector<Accum> next(N*N);
+	rowScales.assign(N, 0);
+
+	for (size_t t = begin; t < end; ++t)
+	{
+		fill(next.begin(), next.end(), Accum(0));
+
+		for (size_t r = 0; r < N; ++r)
+		{
+			Accum* out = &next[r*N];
+
+			for (size_t k = 0; k < N; ++k)
+			{
+				const Accum p = P[r*N + k];
+				if (p == 0)
+					continue;
+
+				const Real* row = &_transitions[k*N];
+				if (maxProduct)
+				{
+					for (size_t j = 0; j < N; ++j)
+						out[j] = max(out[j], p * row[j]);
+				}
+				else
+				{
+					for (size_t j = 0; j < N; ++j)
+						out[j] += p * row[j];
+				}
+			}
+		}
+
+		const Real* b = emissionColumn(obs[t]);
+		for (size_t r = 0; r < N; ++r)
+		{
+			Accum* out = &next[r*N];
+			Accum peak = 0;
+			for (size_t j = 0; j < N; ++j)
+			{
+				out[j] *= b[j];
+				peak = max(peak, out[j]);
+			}
+
+			if (peak <= 0)
+			{
+				rowScales[r] = -numeric_limits<Accum>::infinity();
+				continue;
+			}
+
+			for (size_t j = 0; j < N; ++j)
+				out[j] /= peak;
+			rowScales[r] += log(peak);
+		}
+
+		P.swap(next);
+	}
+}
+
+
+/* Weigh the rows of a chunk matrix for carrying v across it: weights[i] = v[i] / norm *
+ * exp(rowScales[i] - shift), where shift, which is returned, is the largest row scale with
+ * v[i] > 0. Returns -infinity if no state of v has a path across the chunk. */
+template <typename Accum>
+static Accum rowWeights(const vector<Accum>& v, Accum norm, const vector<Accum>& rowScales,
+						vector<Accum>& weights)
+{
+	size_t N = v.size();
+	Accum shift = -numeric_limits<Accum>::infinity();
+	for (size_t i = 0; i < N; ++i)
+		if (v[i] > 0)
+			shift = max(shift, rowScales[i]);
+
+	if (std::isinf(shift))
+		return shift;
+
+	weights.resize(N);
+	for (size_t i = 0; i < N; ++i)
+		weights[i] = (v[i] > 0) ? v[i] / norm * exp(rowScales[i] - shift) : Accum(0);
+	return shift;
+}
+
+
+/* Split t = 1..T-1 into one chunk per thread, which gives the chunk boundaries. */
+static vector<size_t> chunkBounds(size_t T, unsigned threads)
+{
+	size_t chunks = min<size_t>(max(threads, 1u), T-1);
+	vector<size_t> bounds;
+
+	for (size_t c = 0; c <= chunks; ++c)
+		bounds.push_back(1 + (T-1) * c / chunks);
+	return bounds;
+}
+
+
+/* Parallel-in-time forward pass. The sequence is a product of step matrices, which associates:
+ * every thread reduces its chunk of steps to one N x N matrix, and a sweep over the chunks then
+ * carries the alpha vector across each chunk with a single vector-matrix product. */
+template <typename Real, typename Accum>
+double DenseModel<Real, Accum>::parallelLogLikelihood(const vector<int>& obs,
+													  unsigned threads) const
+{
+	if (obs.size() < 2)
+		return sequentialLogLikelihood(obs);
+
+	size_t N = numStates();
+	vector<size_t> bounds = chunkBounds(obs.size(), threads);
+	size_t chunks = bounds.size() - 1;
+
+	vector<vector<Accum> > products(chunks, vector<Accum>(N*N)), rowScales(chunks);
+	vector<thread> workers;
+
+	for (size_t c = 0; c < chunks; ++c)
+	{
+		for (size_t i = 0; i < N; ++i)
+			products[c][i*N + i] = 1;
+
+		workers.push_back(thread([&, c]() {
+			chunkProduct(obs, bounds[c], bounds[c+1], false, products[c], rowScales[c]);
+		}));
+	}
+	for (auto& w : workers)
+		w.join();
+
+	vector<Accum> alpha(N), next(N), weights;
+	for (size_t j = 0; j < N; ++j)
+		alpha[j] = Accum(_initStates[j]) * emissionColumn(obs[0])[j];
+
+	Accum logProb = 0;
+	for (size_t c = 0; c <= chunks; ++c)
+	{
+		Accum sum = 0;
+		for (size_t j = 0; j < N; ++j)
+			sum += alpha[j];
+
+		if (sum <= 0)
+			return -numeric_limits<double>::infinity();
+
+		logProb += log(sum);
+		if (c == chunks)
+			break;
+
+		Accum shift = rowWeights(alpha, sum, rowScales[c], weights);
+		if (std::isinf(shift))
+			return -numeric_limits<double>::infinity();
+
+		fill(next.begin(), next.end(), Accum(0));
+		for (size_t i = 0; i < N; ++i)
+			for (size_t j = 0; j < N; ++j)
+				next[j] += weights[i] * products[c][i*N + j];
+
+		logProb += shift;
+		alpha.swap(next);
+	}
+
+	return logProb;
+}
+
+
+/* Parallel-in-time Viterbi in three passes: the threads reduce their chunks to max-product
+ * matrices; a sweep over the chunks finds the best state at every chunk boundary; then every
+ * thread decodes its chunk between the two boundary states it has been given. */
+template <typename Real, typename Accum>
+pair<double, vector<int> > DenseModel<Real, Accum>::parallelViterbi(const vector<int>& obs,
+																	unsigned threads) const
+{
+	if (obs.size() < 2)
+		return sequentialViterbi(obs);
+
+	size_t N = numStates(), T = obs.size();
+	vector<size_t> bounds = chunkBounds(T, threads);
+	size_t chunks = bounds.size() - 1;
+
+	vector<vector<Accum> > products(chunks, vector<Accum>(N*N)), rowScales(chunks);
+	vector<thread> workers;
+
+	for (size_t c = 0; c < chunks; ++c)
+	{
+		for (size_t i = 0; i < N; ++i)
+			products[c][i*N + i] = 1;
+
+		workers.push_back(thread([&, c]() {
+			chunkProduct(obs, bounds[c], bounds[c+1], true, products[c], rowScales[c]);
+		}));
+	}
+	for (auto& w : workers)
+		w.join();
+	workers.clear();
+
+	/* Carry delta across the chunks, remembering the best state entering each chunk. */
+	vector<Accum> delta(N), next(N), weights;
+	vector<int> entry(chunks*N);
+	Accum logProb = 0;
+
+	for (size_t j = 0; j < N; ++j)
+		delta[j] = Accum(_initStates[j]) * emissionColumn(obs[0])[j];
+
+	for (size_t c = 0; c <= chunks; ++c)
+	{
+		Accum peak = *max_element(delta.begin(), delta.end());
+
+		/* Probability is zero; no such path can be built. */
+		if (peak <= 0)
+			return make_pair(-numeric_limits<double>::infinity(), vector<int>());
+
+		logProb += log(peak);
+		if (c == chunks)
+			break;
+
+		/* No state delta can be in has a path across the chunk. */
+		Accum shift = rowWeights(delta, peak, rowScales[c], weights);
+		if (std::isinf(shift))
+			return make_pair(-numeric_limits<double>::infinity(), vector<int>());
+
+		fill(next.begin(), next.end(), Accum(0));
+		for (size_t i = 0; i < N; ++i)
+			for (size_t j = 0; j < N; ++j)
+			{
+				Accum curr = weights[i] * products[c][i*N + j];
+				if (curr > next[j])
+				{
+					next[j] = curr;
+					entry[c*N + j] = i;
+				}
+			}
+
+		logProb += shift;
+		delta.swap(next);
+	}
+
+	/* Walk back over the chunks to fix the state at every chunk boundary. */
+	vector<int> path(T);
+	path[T-1] = max_element(delta.begin(), delta.end()) - delta.begin();
+
+	for (size_t c = chunks; c-- > 0; )
+		path[bounds[c]-1] = entry[c*N + path[bounds[c+1]-1]];
+
+	for (size_t c = 0; c < chunks; ++c)
+		workers.push_back(thread([&, c]() {
+			decodeSegment(obs, bounds[c], bounds[c+1], path);
+		}));
+	for (auto& w : workers)
+		w.join();
+
+	return make_pair(double(logProb), path);
+}
+
+
+/* Fill path[begin, end-1) with the best states between the fixed states path[begin-1] and
+ * path[end-1]. */
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::decodeSegment(const vector<int>& obs, size_t begin, size_t end,
+											vector<int>& path) const
+{
+	size_t N = numStates();
+	vector<Real> delta(N), next(N);
+	vector<int> backPtr((end - begin)*N);
+
+	delta[path[begin-1]] = 1;
+
+	for (size_t t = begin; t < end; ++t)
+	{
+		fill(next.begin(), next.end(), Real(0));
+		int* ptr = &backPtr[(t - begin)*N];
+
+		for (size_t i = 0; i < N; ++i)
+		{
+			const Real d_i = delta[i];
+			if (d_i == 0)
+				continue;
+
+			const Real* row = &_transitions[i*N];
+			for (size_t j = 0; j < N; ++j)
+			{
+				Real curr = d_i * row[j];
+				if (curr > next[j])
+				{
+					next[j] = curr;
+					ptr[j] = i;
+				}
+			}
+		}
+
+		const Real* b = emissionColumn(obs[t]);
+		Real peak = 0;
+		for (size_t j = 0; j < N; ++j)
+		{
+			next[j] *= b[j];
+			peak = max(peak, next[j]);
+		}
+
+		for (size_t j = 0; j < N; ++j)
+			delta[j] = next[j] / peak;
+	}
+
+	for (size_t t = end-1; t > begin; --t)
+		path[t-1] = backPtr[(t - begin)*N + path[t]];
+}
+
+
+template <typename Real, typename Accum>
+vector<pair<double, vector<string> > > DenseModel<Real, Accum>::nbest(const vector<string>& obs,
+																	   size_t K) const
+{
+	vector<pair<double, vector<string> > > ret;
+
+	for (auto best : nbest(encode(obs), K))
+	{
+		vector<string> path;
+		for (auto stt : best.second)
+			path.push_back(_stateNames[stt]);
+
+		ret.push_back(make_pair(best.first, path));
+	}
+	return ret;
+}
+
+/* List Viterbi (Seshadri & Sundberg, 1994): every trellis cell keeps its K best partial paths,
+ * as a score and a back pointer to the (state, rank) it extends. The K best of the N*K
+ * candidates for a cell are selected with a bounded min-heap; since every predecessor list is
+ * sorted, the scan of a predecessor stops at the first candidate that cannot enter the heap.
+ * Scores are rescaled per column as in viterbi(). */
+template <typename Real, typename Accum>
+vector<pair<double, vector<int> > > DenseModel<Real, Accum>::nbest(const vector<int>& obs,
+																	size_t K) const
+{
+	vector<pair<double, vector<int> > > ret;
+	if (obs.empty() || K == 0)
+		return ret;
+
+	typedef pair<Real, int> Candidate;	// score, predecessor state * K + rank
+	size_t N = numStates(), T = obs.size();
+
+	vector<Real> scores(N*K), next(N*K);
+	vector<size_t> sizes(N), nextSizes(N);
+	vector<int> backPtr(T*N*K);
+	vector<Candidate> heap;
+	Accum logProb = 0;
+
+	const Real* b0 = emissionColumn(obs[0]);
+	for (size_t j = 0; j < N; ++j)
+	{
+		scores[j*K] = _initStates[j] * b0[j];
+		sizes[j] = (scores[j*K] > 0) ? 1 : 0;
+	}
+
+	for (size_t t = 0; t < T; ++t)
+	{
+		if (t > 0)
+		{
+			const Real* bt = emissionColumn(obs[t]);
+
+			for (size_t j = 0; j < N; ++j)
+			{
+				heap.clear();
+
+				for (size_t i = 0; i < N; ++i)
+				{
+					const Real a_ij = transition(i, j);
+					if (a_ij == 0)
+						continue;
+
+					for (size_t r = 0; r < sizes[i]; ++r)
+					{
+						Real curr = scores[i*K + r] * a_ij;
+
+						if (heap.size() == K)
+						{
+							if (!(curr > heap.front().first))
+								break;
+
+							pop_heap(heap.begin(), heap.end(), greater<Candidate>());
+							heap.pop_back();
+						}
+						heap.push_back(Candidate(curr, i*K + r));
+						push_heap(heap.begin(), heap.end(), greater<Candidate>());
+					}
+				}
+
+				sort_heap(heap.begin(), heap.end(), greater<Candidate>());
+
+				const Real b = bt[j];
+				nextSizes[j] = (b > 0) ? heap.size() : 0;
+				for (size_t r = 0; r < nextSizes[j]; ++r)
+				{
+					next[j*K + r] = heap[r].first * b;
+					backPtr[(t*N + j)*K + r] = heap[r].second;
+				}
+			}
+
+			scores.swap(next);
+			sizes.swap(nextSizes);
+		}
+
+		/* Each list is sorted, so the column peak is the largest head. */
+		Real peak = 0;
+		for (size_t j = 0; j < N; ++j)
+			if (sizes[j] > 0)
+				peak = max(peak, scores[j*K]);
+
+		/* Probability is zero; no such path can be built. */
+		if (peak <= 0)
+			return ret;
+
+		for (size_t j = 0; j < N; ++j)
+			for (size_t r = 0; r < sizes[j]; ++r)
+				scores[j*K + r] /= peak;
+
+		logProb += log(Accum(peak));
+	}
+
+	/* Select the K best final cells and follow each one's back pointers. */
+	vector<Candidate> finals;
+	for (size_t j = 0; j < N; ++j)
+		for (size_t r = 0; r < sizes[j]; ++r)
+			finals.push_back(Candidate(scores[j*K + r], j*K + r));
+
+	size_t count = min(K, finals.size());
+	partial_sort(finals.begin(), finals.begin() + count, finals.end(), greater<Candidate>());
+
+	for (size_t k = 0; k < count; ++k)
+	{
+		vector<int> path(T);
+		int cell = finals[k].second;
+
+		for (size_t t = T; t-- > 0; )
+		{
+			path[t] = cell / K;
+			if (t > 0)
+				cell = backPtr[(t*N + cell / K)*K + cell % K];
+		}
+
+		ret.push_back(make_pair(double(logProb + log(Accum(finals[k].first))), path));
+	}
+	return ret;
+}
+
+
+template <typename Real, typename Accum>
+vector<double> DenseModel<Real, Accum>::logLikelihoods(const vector<vector<string> >& batch) const
+{
+	vector<vector<int> > sequences;
+	for (auto obs : batch)
+		sequences.push_back(encode(obs));
+
+	/* A lone sequence gains nothing from batching, but may from the parallel scan. */
+	if (sequences.size() == 1)
+		return vector<double>(1, logLikelihood(sequences[0]));
+
+	BatchOptions options;
+	options.threads = max(1u, thread::hardware_concurrency());
+	return batchLogLikelihood(sequences, options);
+}
+
+
+template <typename Real, typename Accum>
+vector<double> DenseModel<Real, Accum>::batchLogLikelihood(const vector<vector<int> >& batch,
+														   const BatchOptions& options) const
+{
+	vector<double> ret;
+	for (auto result : runBatch(batch, options, false))
+		ret.push_back(result.first);
+	return ret;
+}
+
+
+template <typename Real, typename Accum>
+vector<pair<double, vector<int> > >
+DenseModel<Real, Accum>::batchViterbi(const vector<vector<int> >& batch,
+									  const BatchOptions& options) const
+{
+	return runBatch(batch, options, true);
+}
+
+
+/* Side of the square tiles of A: half the L2 cache, leaving the rest for the trellis slices. */
+static size_t defaultTile(size_t elementSize)
+{
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (l2 <= 0)
+		l2 = 256 << 10;
+
+	size_t side = sqrt(double(l2) / 2 / elementSize);
+	return max<size_t>(16, side / 16 * 16);
+}
+
+/* The CPUs the calling thread may run on, which respects the cpuset the process was started in
+ * rather than assuming CPUs 0 to hardware_concurrency() - 1. Empty if they cannot be queried. */
+static vector<int> allowedCpus()
+{
+	vector<int> ret;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) != 0)
+		return ret;
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		if (CPU_ISSET(cpu, &set))
+			ret.push_back(cpu);
+	return ret;
+}
+
+/* Restrict the calling thread to one CPU, so the memory it first touches stays local to it.
+ * Returns false if the thread could not be pinned. */
+static bool pinToCpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+
+/* Deal the sequences, longest first, round-robin to the threads, so every thread gets a similar
+ * amount of work and its sequences drop out of the lock step in order. */
+template <typename Real, typename Accum>
+vector<pair<double, vector<int> > >
+DenseModel<Real, Accum>::runBatch(const vector<vector<int> >& batch, const BatchOptions& options,
+								  bool maxProduct) const
+{
+	vector<pair<double, vector<int> > > ret(batch.size());
+
+	vector<size_t> order(batch.size());
+	for (size_t k = 0; k < order.size(); ++k)
+		order[k] = k;
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return batch[a].size() > batch[b].size();
+	});
+
+	unsigned threads = max<size_t>(1, min<size_t>(options.threads, batch.size()));
+	size_t tile = min(numStates(), options.tile > 0 ? options.tile : defaultTile(sizeof(Real)));
+
+	/* Worker w always runs on the same CPU, so the replica it first touched on an earlier call
+	 * is still local to it. Slots are only added here, before the workers start. */
+	unique_lock<mutex> lock(*_replicaMutex, defer_lock);
+	vector<int> cpus;
+	if (options.replicate)
+	{
+		lock.lock();
+		cpus = allowedCpus();
+		if (_replicas.size() < threads)
+			_replicas.resize(threads);
+	}
+
+	auto work = [&](unsigned w) {
+		vector<const vector<int>*> sequences;
+		vector<pair<double, vector<int> >*> results;
+
+		for (size_t k = w; k < order.size(); k += threads)
+		{
+			sequences.push_back(&batch[order[k]]);
+			results.push_back(&ret[order[k]]);
+		}
+
+		/* A worker that cannot be pinned would first-touch its replica wherever it happens to
+		 * run, so it reads the shared A instead. */
+		const Real* A = _transitions.data();
+
+		if (options.replicate && !cpus.empty() && pinToCpu(cpus[w % cpus.size()]))
+		{
+			vector<Real>& replica = _replicas[w];
+			if (replica.empty())
+				replica = _transitions;
+			A = replica.data();
+		}
+
+		tiledPass(sequences, maxProduct, A, tile, results);
+	};
+
+	/* Pinning sets the affinity of the thread running the work for good, so pinned work never
+	 * runs on the caller's thread. */
+	if (threads == 1 && !options.replicate)
+		work(0);
+	else
+	{
+		vector<thread> workers;
+		for (unsigned w = 0; w < threads; ++w)
+			workers.push_back(thread(work, w));
+		for (auto& w : workers)
+			w.join();
+	}
+
+	return ret;
+}
+
+
+/* The lock step trellis of one thread. Sequences are sorted by decreasing length, so the ones
+ * still running at any time step are a prefix. Per step, the (i, j) tile loops are outermost and
+ * the sequence loop inside them, which keeps each tile of A in cache while all sequences use it. */
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::tiledPass(const vector<const vector<int>*>& sequences,
+										bool maxProduct, const Real* A, size_t tile,
+										const vector<pair<double, vector<int> >*>& results) const
+{
+	size_t N = numStates(), S = sequences.size();
+	if (S == 0)
+		return;
+
+	vector<Real> alpha(S*N);
+	vector<Accum> next(S*N), logProb(S);
+	vector<char> dead(S);
+	vector<int> best(S);
+	vector<vector<int> > backPtr(maxProduct ? S : 0);
+
+	for (size_t s = 0; s < backPtr.size(); ++s)
+		backPtr[s].resize(sequences[s]->size()*N);
+
+	size_t active = S;
+
+	for (size_t t = 0; t < sequences[0]->size(); ++t)
+	{
+		while (sequences[active-1]->size() <= t)
+			--active;
+
+		if (t == 0)
+		{
+			for (size_t s = 0; s < active; ++s)
+			{
+				const Real* b = emissionColumn((*sequences[s])[0]);
+				for (size_t j = 0; j < N; ++j)
+					next[s*N + j] = Accum(_initStates[j]) * b[j];
+			}
+		}
+		else
+		{
+			fill(next.begin(), next.begin() + active*N, Accum(0));
+
+			for (size_t i0 = 0; i0 < N; i0 += tile)
+			{
+				size_t i1 = min(i0 + tile, N);
+
+				for (size_t j0 = 0; j0 < N; j0 += tile)
+				{
+					size_t j1 = min(j0 + tile, N);
+
+					for (size_t s = 0; s < active; ++s)
+					{
+						if (dead[s])
+							continue;
+
+						const Real* a = &alpha[s*N];
+						Accum* out = &next[s*N];
+						int* ptr = maxProduct ? &backPtr[s][t*N] : NULL;
+
+						for (size_t i = i0; i < i1; ++i)
+						{
+							const Real a_i = a[i];
+							if (a_i == 0)
+								continue;
+
+							const Real* row = &A[i*N];
+							if (maxProduct)
+							{
+								for (size_t j = j0; j < j1; ++j)
+								{
+									Accum curr = Accum(a_i) * row[j];
+									if (curr > out[j])
+									{
+										out[j] = curr;
+										ptr[j] = i;
+									}
+								}
+							}
+							else
+							{
+								for (size_t j = j0; j < j1; ++j)
+									out[j] += Accum(a_i) * row[j];
+							}
+						}
+					}
+				}
+			}
+
+			for (size_t s = 0; s < active; ++s)
+			{
+				const Real* b = emissionColumn((*sequences[s])[t]);
+				for (size_t j = 0; j < N; ++j)
+					next[s*N + j] *= b[j];
+			}
+		}
+
+		/* Rescale every column to sum (or peak) at one. */
+		for (size_t s = 0; s < active; ++s)
+		{
+			if (dead[s])
+				continue;
+
+			Accum* col = &next[s*N];
+			Accum scale = 0;
+			for (size_t j = 0; j < N; ++j)
+			{
+				if (!maxProduct)
+					scale += col[j];
+				else if (col[j] > scale)
+				{
+					scale = col[j];
+					best[s] = j;
+				}
+			}
+
+			if (scale <= 0)
+			{
+				dead[s] = 1;
+				continue;
+			}
+
+			for (size_t j = 0; j < N; ++j)
+				alpha[s*N + j] = Real(col[j] / scale);
+			logProb[s] += log(scale);
+		}
+	}
+
+	for (size_t s = 0; s < S; ++s)
+	{
+		pair<double, vector<int> >& result = *results[s];
+		size_t T = sequences[s]->size();
+
+		if (dead[s])
+		{
+			result = make_pair(-numeric_limits<double>::infinity(), vector<int>());
+			continue;
+		}
+
+		result.first = logProb[s];
+		if (!maxProduct || T == 0)
+			continue;
+
+		/* Follow the back pointers from the peak of the final column. */
+		vector<int>& path = result.second;
+		path.resize(T);
+		path[T-1] = best[s];
+
+		for (size_t t = T-1; t > 0; --t)
+			path[t-1] = backPtr[s][t*N + path[t]];
+	}
+}
+
+
+/* Pick the checkpoint stride of the forward-backward pass: the whole sequence if its trellis fits
+ * the memory budget, else sqrt(T), which keeps about 2 sqrt(T) columns at once. */
+template <typename Real, typename Accum>
+size_t DenseModel<Real, Accum>::checkpointStride(size_t T) const
+{
+	size_t columnBytes = numStates()*sizeof(Real) + sizeof(Accum);
+
+	if (_memoryBudget == 0 || T*columnBytes <= _memoryBudget)
+		return T;
+
+	size_t stride = ceil(sqrt(double(T)));
+	if ((T + stride - 1) / stride + stride > _memoryBudget / columnBytes)
+		throw runtime_error("sequence of " + to_string(T) + " steps exceeds the memory budget");
+
+	return stride;
+}
+
+
+/* Scaled forward-backward (Rabiner, section V.A). With alpha columns normalized by c_t and beta
+ * columns divided by the same c_t, gamma_t(i) = alpha_t(i) * beta_t(i) and
+ * xi_t(i,j) = alpha_t(i) * a_ij * b_j(o_t+1) * beta_t+1(j) / c_t+1 need no further normalization.
+ *
+ * Only the first alpha column of every segment of checkpointStride() steps is kept by the
+ * forward sweep. The backward sweep recomputes each segment's columns from its checkpoint just
+ * before it walks through that segment, so memory is O(N (T / stride + stride)) at the cost of
+ * at most one extra forward pass. */
+template <typename Real, typename Accum>
+double DenseModel<Real, Accum>::accumulate(const vector<int>& obs, ExpectedCounts& counts) const
+{
+	if (obs.empty())
+		return 0;
+
+	size_t N = numStates(), M = numOutputs(), T = obs.size();
+	size_t stride = checkpointStride(T), segments = (T + stride - 1) / stride;
+	size_t last = (segments - 1)*stride;
+
+	vector<Real> checkpoints(segments*N), segment(stride*N), ring(2*N);
+	vector<Accum> checkpointScales(segments), segmentScales(stride), scratch(N);
+	Accum logProb = 0;
+
+	/* The last segment is walked first by the backward sweep, so keep all of its columns. */
+	const Real* prev = NULL;
+	for (size_t t = 0; t < T; ++t)
+	{
+		Real* cur = (t >= last) ? &segment[(t - last)*N] : &ring[(t % 2)*N];
+
+		Accum scale = forwardStep(obs, t, prev, cur, scratch);
+		if (scale <= 0)
+			return -numeric_limits<double>::infinity();
+
+		logProb += log(scale);
+		if (t >= last)
+			segmentScales[t - last] = scale;
+		if (t % stride == 0)
+		{
+			copy(cur, cur + N, &checkpoints[(t / stride)*N]);
+			checkpointScales[t / stride] = scale;
+		}
+		prev = cur;
+	}
+
+	vector<Accum> beta(N, Accum(1));
+
+	for (size_t m = segments; m-- > 0; )
+	{
+		size_t begin = m*stride, end = min(begin + stride, T);
+
+		if (begin != last)
+		{
+			copy(&checkpoints[m*N], &checkpoints[m*N] + N, segment.begin());
+			segmentScales[0] = checkpointScales[m];
+
+			for (size_t t = begin+1; t < end; ++t)
+				segmentScales[t - begin] = forwardStep(obs, t, &segment[(t - begin - 1)*N],
+													   &segment[(t - begin)*N], scratch);
+		}
+
+		/* Step back across the boundary from the first column of the following segment. */
+		if (end < T)
+			backwardStep(obs, end, &segment[(end - begin - 1)*N], checkpointScales[m+1], beta,
+						 scratch, counts);
+
+		for (size_t t = end; t-- > begin; )
+		{
+			const Real* a_t = &segment[(t - begin)*N];
+
+			for (size_t i = 0; i < N; ++i)
+			{
+				double g = Accum(a_t[i]) * beta[i];
+				counts.emissions[i*M + obs[t]] += g;
+				if (t == 0)
+					counts.initStates[i] += g;
+			}
+
+			if (t > begin)
+				backwardStep(obs, t, &segment[(t - begin - 1)*N], segmentScales[t - begin], beta,
+							 scratch, counts);
+		}
+	}
+
+	++counts.sequences;
+	counts.logLikelihood += logProb;
+	return logProb;
+}
+
+
+/* Add xi_t-1 to the transition counts and turn beta from beta_t into beta_t-1, given the alpha
+ * column at t-1 and the normalizer c_t. */
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::backwardStep(const vector<int>& obs, size_t t, const Real* alphaPrev,
+										   Accum scale, vector<Accum>& beta,
+										   vector<Accum>& weighted, ExpectedCounts& counts) const
+{
+	size_t N = numStates();
+	const Real* b = emissionColumn(obs[t]);
+
+	/* weighted(j) = b_j(o_t) * beta_t(j) / c_t, shared by xi_t-1 and beta_t-1. A fused output's
+	 * matrix already carries b(o_t). */
+	const Real* fused = fusedTransitions(obs[t]);
+	const Real* A = fused ? fused : _transitions.data();
+
+	for (size_t j = 0; j < N; ++j)
+		weighted[j] = (fused ? beta[j] : Accum(b[j]) * beta[j]) / scale;
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		const Real* row = &A[i*N];
+		double* xi = &counts.transitions[i*N];
+		Accum sum = 0;
+
+		for (size_t j = 0; j < N; ++j)
+		{
+			Accum w = Accum(row[j]) * weighted[j];
+			sum += w;
+			xi[j] += Accum(alphaPrev[i]) * w;
+		}
+		beta[i] = sum;
+	}
+}
+
+
+template <typename Real, typename Accum>
+size_t DenseModel<Real, Accum>::fuseHotOutputs(const vector<vector<int> >& profile, size_t maxBytes)
+{
+	size_t N = numStates(), M = numOutputs();
+
+	vector<size_t> counts(M);
+	for (auto& obs : profile)
+		for (auto o : obs)
+			++counts.at(o);
+
+	vector<int> order(M);
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&](int a, int b) { return counts[a] > counts[b]; });
+
+	size_t fit = min(M, maxBytes / (N*N*sizeof(Real)));
+
+	_fusedOutputs.clear();
+	for (size_t k = 0; k < fit && counts[order[k]] > 0; ++k)
+		_fusedOutputs.push_back(order[k]);
+
+	prepareEmissions();
+	return _fusedOutputs.size();
+}
+
+
+/* Rebuild the symbol-major copy of B and the fused matrices after A or B has changed, and drop
+ * the stale replicas of A. */
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::prepareEmissions()
+{
+	size_t N = numStates(), M = numOutputs();
+
+	_replicas.clear();
+
+	_emissionColumns.resize(M*N);
+	for (size_t i = 0; i < N; ++i)
+		for (size_t o = 0; o < M; ++o)
+			_emissionColumns[o*N + i] = _emissions[i*M + o];
+
+	_fusedSlot.assign(M, -1);
+	_fused.resize(_fusedOutputs.size()*N*N);
+
+	for (size_t f = 0; f < _fusedOutputs.size(); ++f)
+	{
+		const Real* b = emissionColumn(_fusedOutputs[f]);
+		Real* fused = &_fused[f*N*N];
+
+		for (size_t i = 0; i < N; ++i)
+			for (size_t j = 0; j < N; ++j)
+				fused[i*N + j] = _transitions[i*N + j] * b[j];
+
+		_fusedSlot[_fusedOutputs[f]] = f;
+	}
+}
+
+
+/* Returns A_ij * b_j(o) if output o is fused, else NULL. */
+template <typename Real, typename Accum>
+const Real* DenseModel<Real, Accum>::fusedTransitions(int o) const
+{
+	int f = _fusedSlot[o];
+	return (f < 0) ? NULL : &_fused[f*numStates()*numStates()];
+}
+
+
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::reestimate(const ExpectedCounts& counts)
+{
+	size_t N = numStates(), M = numOutputs();
+	if (counts.numStates != N || counts.numOutputs != M)
+		throw runtime_error("expected counts do not match the model");
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		double sum = 0;
+		for (size_t j = 0; j < N; ++j)
+			sum += counts.transitions[i*N + j];
+		if (sum > 0)
+			for (size_t j = 0; j < N; ++j)
+				_transitions[i*N + j] = counts.transitions[i*N + j] / sum;
+
+		sum = 0;
+		for (size_t o = 0; o < M; ++o)
+			sum += counts.emissions[i*M + o];
+		if (sum > 0)
+			for (size_t o = 0; o < M; ++o)
+				_emissions[i*M + o] = counts.emissions[i*M + o] / sum;
+	}
+
+	if (counts.sequences > 0)
+		for (size_t i = 0; i < N; ++i)
+			_initStates[i] = counts.initStates[i] / counts.sequences;
+
+	prepareEmissions();
+}
+
+
+/* Parameters always travel as doubles, so models of any precision can exchange them. */
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::writeParameters(ostream& out) const
+{
+	uint32_t header[2] = {uint32_t(numStates()), uint32_t(numOutputs())};
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+	const vector<Real>* matrices[] = {&_transitions, &_emissions, &_initStates};
+	for (auto matrix : matrices)
+	{
+		vector<double> tmp(matrix->begin(), matrix->end());
+		out.write(reinterpret_cast<const char*>(tmp.data()), tmp.size()*sizeof(double));
+	}
+
+	if (!out)
+		throw runtime_error("cannot write model parameters");
+}
+
+
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::readParameters(istream& in)
+{
+	uint32_t header[2];
+	in.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!in || header[0] != numStates() || header[1] != numOutputs())
+		throw runtime_error("model parameters do not match the model");
+
+	vector<Real>* matrices[] = {&_transitions, &_emissions, &_initStates};
+	for (auto matrix : matrices)
+	{
+		vector<double> tmp(matrix->size());
+		in.read(reinterpret_cast<char*>(tmp.data()), tmp.size()*sizeof(double));
+		copy(tmp.begin(), tmp.end(), matrix->begin());
+	}
+
+	if (!in)
+		throw runtime_error("truncated model parameters");
+
+	prepareEmissions();
+}
+
+
+template <typename Real, typename Accum>
+void DenseModel<Real, Accum>::save(const string& filename) const
+{
+	ofstream file(filename);
+	if (!file.is_open())
+		throw runtime_error("cannot create file: " + filename);
+
+	/* Enough digits for every parameter to read back as the same double. */
+	file.precision(numeric_limits<double>::max_digits10);
+
+	size_t N = numStates(), M = numOutputs();
+	file << N << " " << M << " " << _numOfTimeSteps << endl;
+
+	/* Write state names. */
+	for (auto stt : _stateNames)
+		file << stt << " ";
+	file << endl;
+
+	/* Write observation symbols. */
+	for (auto out : _outputNames)
+		file << out << " ";
+	file << endl;
+
+	/* Write transition matrix. */
+	file << "a:" << endl;
+	for (size_t i = 0; i < N; ++i)
+	{
+		for (size_t j = 0; j < N; ++j)
+			file << transition(i, j) << " ";
+		file << endl;
+	}
+
+	/* Write emission matrix. */
+	file << "b:" << endl;
+	for (size_t i = 0; i < N; ++i)
+	{
+		for (size_t o = 0; o < M; ++o)
+			file << emission(i, o) << " ";
+		file << endl;
+	}
+
+	/* Write initial state matrix. */
+	file << "pi:" << endl;
+	for (size_t i = 0; i < N; ++i)
+		file << initState(i) << " ";
+	file << endl;
+}
+
+
+template class DenseModel<double, double>;
+template class DenseModel<float, float>;
+template class DenseModel<float, double>;
+
+
+unique_ptr<Scorer> loadScorer(const string& filename, Precision precision)
+{
+	HiddenMarkovModel hmm(filename);
+
+	switch (precision)
+	{
+	case Precision::Single:
+		return unique_ptr<Scorer>(new DenseModel<float, float>(hmm));
+	case Precision::Mixed:
+		return unique_ptr<Scorer>(new DenseModel<float, double>(hmm));
+	default:
+		return unique_ptr<Scorer>(new DenseModel<double, double>(hmm));
+	}
+}
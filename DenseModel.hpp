@@ -0,0 +1,248 @@
+#ifndef GUARD_DENSE_MODEL_HPP
+#define GUARD_DENSE_MODEL_HPP
+
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ExpectedCounts.hpp"
+
+class HiddenMarkovModel;
+
+
+/** Storage precision of a dense model, chosen when the model is loaded. */
+enum class Precision
+{
+	Double,	// model, trellis and accumulators in double
+	Single,	// model, trellis and accumulators in float
+	Mixed	// model and trellis in float, accumulators in double
+};
+
+/** Parse a precision name: "double", "float" (or "single") or "mixed". */
+Precision parsePrecision(const std::string& name);
+
+
+/**
+ * Precision independent interface to a dense model. Scores are natural log-probabilities, so
+ * they stay finite where the plain probabilities returned by HiddenMarkovModel underflow.
+ */
+class Scorer
+{
+public:
+	virtual ~Scorer() {}
+
+	/**
+	 * Returns log P(obs | model), or -infinity if the sequence cannot be produced.
+	 */
+	virtual double logLikelihood(const std::vector<std::string>& obs) const = 0;
+	/**
+	 * Returns the log-probability of the most likely state path and the path itself. The path
+	 * is empty if no path can produce the sequence.
+	 */
+	virtual std::pair<double, std::vector<std::string> >
+		viterbi(const std::vector<std::string>& obs) const = 0;
+	/**
+	 * Returns up to K state paths in order of decreasing probability, each with its
+	 * log-probability. Fewer are returned if fewer paths can produce the sequence.
+	 */
+	virtual std::vector<std::pair<double, std::vector<std::string> > >
+		nbest(const std::vector<std::string>& obs, size_t K) const = 0;
+	/**
+	 * Returns log P(obs | model) for every sequence of a batch, scoring them together.
+	 */
+	virtual std::vector<double>
+		logLikelihoods(const std::vector<std::vector<std::string> >& batch) const = 0;
+};
+
+
+/** How the batched trellis passes of a DenseModel divide and place their work. */
+struct BatchOptions
+{
+	BatchOptions() : threads(1), tile(0), replicate(false) {}
+
+	unsigned threads;	// threads, each taking every threads-th sequence by length
+	size_t tile;		// side of the square tiles of A, or 0 to fit half the L2 cache
+	bool replicate;		// pin each thread to a CPU of the process and give it a private,
+						// first-touched copy of A, so that on NUMA hosts it lives in the
+						// thread's local memory; the copies are kept until A changes
+};
+
+
+/**
+ * Index based copy of a HiddenMarkovModel. The A, B and pi matrices and the trellis columns are
+ * stored as contiguous arrays of Real; sums and log-likelihoods are accumulated in Accum. Every
+ * trellis column is rescaled to sum (or peak) at one, so single precision does not underflow.
+ *
+ * Besides the row-major B, the model keeps B symbol-major: the N emission probabilities of each
+ * output in one contiguous column, so a trellis step reads b(o_t) without striding across the
+ * rows of B. For the outputs fused by fuseHotOutputs(), it also keeps A_ij * b_j(o), which turns
+ * a sequential forward, backward or Viterbi step on such an output into a plain vector-matrix
+ * product.
+ */
+template <typename Real, typename Accum = Real>
+class DenseModel : public Scorer
+{
+public:
+	DenseModel(HiddenMarkovModel& hmm);
+	/**
+	 * Build a model from row-major N x N transitions, N x M emissions and N initial states.
+	 */
+	DenseModel(const std::vector<std::string>& states, const std::vector<std::string>& outputs,
+			   const std::vector<double>& transitions, const std::vector<double>& emissions,
+			   const std::vector<double>& initStates, size_t timeSteps = 0);
+
+	size_t numStates() const { return _stateNames.size(); }
+	size_t numOutputs() const { return _outputNames.size(); }
+	const std::vector<std::string>& states() const { return _stateNames; }
+	const std::vector<std::string>& outputs() const { return _outputNames; }
+
+	Real transition(size_t i, size_t j) const { return _transitions[i*numStates() + j]; }
+	Real emission(size_t i, size_t o) const { return _emissions[i*numOutputs() + o]; }
+	Real initState(size_t i) const { return _initStates[i]; }
+
+	/**
+	 * Map an observation sequence to output symbol indices.
+	 */
+	std::vector<int> encode(const std::vector<std::string>& obs) const;
+
+	double logLikelihood(const std::vector<std::string>& obs) const;
+	double logLikelihood(const std::vector<int>& obs) const;
+
+	std::pair<double, std::vector<std::string> > viterbi(const std::vector<std::string>& obs) const;
+	std::pair<double, std::vector<int> > viterbi(const std::vector<int>& obs) const;
+
+	std::vector<std::pair<double, std::vector<std::string> > >
+		nbest(const std::vector<std::string>& obs, size_t K) const;
+	std::vector<std::pair<double, std::vector<int> > > nbest(const std::vector<int>& obs,
+															 size_t K) const;
+
+	std::vector<double> logLikelihoods(const std::vector<std::vector<std::string> >& batch) const;
+
+	/**
+	 * Count the outputs of the sequences of profile, and keep a fused N x N matrix A_ij * b_j(o)
+	 * for each output o in order of decreasing count, as long as they fit in maxBytes. Outputs
+	 * that never occur are not fused. Replaces any earlier choice; with maxBytes 0 nothing stays
+	 * fused. Returns the number of outputs fused.
+	 */
+	size_t fuseHotOutputs(const std::vector<std::vector<int> >& profile, size_t maxBytes);
+	/** Returns the fused outputs, most frequent first. */
+	const std::vector<int>& fusedOutputs() const { return _fusedOutputs; }
+	/**
+	 * Forward pass over a batch of sequences in lock step. A is processed in cache sized tiles,
+	 * and each tile is applied to every sequence of a thread before moving to the next, so A is
+	 * streamed from memory once per time step rather than once per sequence and time step.
+	 * Returns log P(obs | model) of every sequence, in batch order.
+	 */
+	std::vector<double> batchLogLikelihood(const std::vector<std::vector<int> >& batch,
+										   const BatchOptions& options = BatchOptions()) const;
+	/**
+	 * Viterbi over a batch of sequences, tiled like batchLogLikelihood().
+	 */
+	std::vector<std::pair<double, std::vector<int> > >
+		batchViterbi(const std::vector<std::vector<int> >& batch,
+					 const BatchOptions& options = BatchOptions()) const;
+
+	/**
+	 * Returns true if the parallel-in-time passes are expected to beat the sequential ones for a
+	 * sequence of T steps on the given number of threads. logLikelihood() and viterbi() use them
+	 * when this holds for the hardware thread count.
+	 */
+	bool useParallelScan(size_t T, unsigned threads) const;
+	/**
+	 * Forward pass split over threads by time: each chunk of steps is reduced to an N x N matrix
+	 * in parallel, and the chunks are combined in order.
+	 */
+	double parallelLogLikelihood(const std::vector<int>& obs, unsigned threads) const;
+	/**
+	 * Viterbi split over threads by time, using max-product chunk matrices.
+	 */
+	std::pair<double, std::vector<int> > parallelViterbi(const std::vector<int>& obs,
+														 unsigned threads) const;
+
+	/**
+	 * Limit the memory the Baum-Welch E-step may use for the trellis of one sequence, in bytes,
+	 * or lift the limit with 0. Sequences whose full trellis exceeds the budget are processed
+	 * with checkpointed forward-backward instead, which recomputes part of the forward pass.
+	 */
+	void setMemoryBudget(size_t bytes) { _memoryBudget = bytes; }
+
+	/**
+	 * Baum-Welch E-step: add the expected counts of a single sequence to counts and return its
+	 * log-likelihood. Sequences that cannot be produced add nothing and return -infinity.
+	 */
+	double accumulate(const std::vector<int>& obs, ExpectedCounts& counts) const;
+	/**
+	 * Baum-Welch M-step: replace A, B and pi by the normalized counts. Rows without any counts
+	 * keep their current probabilities.
+	 */
+	void reestimate(const ExpectedCounts& counts);
+
+	/**
+	 * Write the A, B and pi matrices in a compact binary format, for handing the model to
+	 * another process that already holds the state and output names.
+	 */
+	void writeParameters(std::ostream& out) const;
+	/**
+	 * Replace the A, B and pi matrices by ones written with writeParameters().
+	 */
+	void readParameters(std::istream& in);
+	/**
+	 * Write this model as an .hmm file.
+	 */
+	void save(const std::string& filename) const;
+
+private:
+	double sequentialLogLikelihood(const std::vector<int>&) const;
+	std::pair<double, std::vector<int> > sequentialViterbi(const std::vector<int>&) const;
+
+	Accum forwardStep(const std::vector<int>&, size_t, const Real*, Real*,
+					  std::vector<Accum>&) const;
+	void backwardStep(const std::vector<int>&, size_t, const Real*, Accum, std::vector<Accum>&,
+					  std::vector<Accum>&, ExpectedCounts&) const;
+	size_t checkpointStride(size_t) const;
+
+	void prepareEmissions();
+	const Real* emissionColumn(int o) const { return &_emissionColumns[o*numStates()]; }
+	const Real* fusedTransitions(int o) const;
+
+	void chunkProduct(const std::vector<int>&, size_t, size_t, bool, std::vector<Accum>&,
+					  std::vector<Accum>&) const;
+	void decodeSegment(const std::vector<int>&, size_t, size_t, std::vector<int>&) const;
+
+	std::vector<std::pair<double, std::vector<int> > >
+		runBatch(const std::vector<std::vector<int> >&, const BatchOptions&, bool) const;
+	void tiledPass(const std::vector<const std::vector<int>*>&, bool, const Real*, size_t,
+				   const std::vector<std::pair<double, std::vector<int> >*>&) const;
+
+private:
+	size_t _numOfTimeSteps, _memoryBudget;
+	std::vector<std::string> _stateNames, _outputNames;
+	std::map<std::string, int> _outputIndex;
+
+	std::vector<Real> _transitions;	// N x N, row i holds transitions out of state i
+	std::vector<Real> _emissions;	// N x M, row i holds emissions of state i
+	std::vector<Real> _initStates;	// N
+
+	/* Derived from A and B by prepareEmissions(). */
+	std::vector<Real> _emissionColumns;	// M x N, row o holds b_i(o) of every state i
+	std::vector<int> _fusedOutputs;		// outputs with a fused matrix, hottest first
+	std::vector<int> _fusedSlot;		// M, index of output o in _fusedOutputs, or -1
+	std::vector<Real> _fused;			// one N x N matrix A_ij * b_j(o) per fused output
+
+	/* Copies of A for the replicated batch passes, one per worker, each first touched by the
+	 * worker pinned to the same CPU on every call. Cleared by prepareEmissions(); the mutex
+	 * keeps replicated passes on one model from overlapping. */
+	mutable std::vector<std::vector<Real> > _replicas;
+	std::unique_ptr<std::mutex> _replicaMutex;
+};
+
+
+/**
+ * Load the .hmm file filename into a dense model of the given precision.
+ */
+std::unique_ptr<Scorer> loadScorer(const std::string& filename, Precision precision);
+
+
+#endif
@@ -0,0 +1,256 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Distributed.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+
+/* Messages are a uint64 length followed by that many bytes. A zero length message tells a worker
+ * to exit. */
+static void sendMessage(int fd, const string& msg)
+{
+	uint64_t len = msg.size();
+	string buf(reinterpret_cast<const char*>(&len), sizeof(len));
+	buf += msg;
+
+	for (size_t done = 0; done < buf.size(); )
+	{
+		ssize_t n = write(fd, buf.data() + done, buf.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			throw runtime_error("cannot write to worker pipe");
+		done += n;
+	}
+}
+
+/* Returns false if the other end has closed the pipe. */
+static bool receiveMessage(int fd, string& msg)
+{
+	uint64_t len = 0;
+	char* dst = reinterpret_cast<char*>(&len);
+	size_t want = sizeof(len);
+
+	for (int part = 0; part < 2; ++part)
+	{
+		for (size_t done = 0; done < want; )
+		{
+			ssize_t n = read(fd, dst + done, want - done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			done += n;
+		}
+
+		if (part == 0)
+		{
+			msg.resize(len);
+			dst = &msg[0];
+			want = len;
+		}
+	}
+	return true;
+}
+
+
+/* Worker loop: wait for parameters, run the E-step over the shard, reply with the counts. */
+static void runWorker(DenseModel<double>& model, const Shard& shard, int in, int out)
+{
+	vector<vector<int> > sequences;
+	size_t k = 0;
+
+	for (auto filename : shard.obsFilenames)
+		for (auto obs : parseObsFile(filename))
+			if (k++ % shard.stride == shard.offset)
+				sequences.push_back(model.encode(obs));
+
+	ExpectedCounts counts(model.numStates(), model.numOutputs());
+	string msg;
+
+	while (receiveMessage(in, msg) && !msg.empty())
+	{
+		istringstream params(msg);
+		model.readParameters(params);
+
+		counts.clear();
+		for (auto obs : sequences)
+			model.accumulate(obs, counts);
+
+		ostringstream reply;
+		counts.write(reply);
+		sendMessage(out, reply.str());
+	}
+}
+
+
+/* Ignore SIGPIPE for as long as the coordinator runs, so that a dead worker surfaces as a failed
+ * write rather than killing the process, then hand the previous disposition back to the program
+ * that called trainDistributed(). */
+struct IgnoreSigpipe
+{
+	IgnoreSigpipe()
+	{
+		struct sigaction ignore;
+		ignore.sa_handler = SIG_IGN;
+		sigemptyset(&ignore.sa_mask);
+		ignore.sa_flags = 0;
+		sigaction(SIGPIPE, &ignore, &previous);
+	}
+	~IgnoreSigpipe() { sigaction(SIGPIPE, &previous, NULL); }
+
+	struct sigaction previous;
+};
+
+
+/* The pipes and processes of the forked workers. */
+struct Workers
+{
+	~Workers() { stop(); }
+
+	/* Tell every worker to stop, close its pipes and reap it. */
+	void stop()
+	{
+		for (size_t w = 0; w < pids.size(); ++w)
+		{
+			/* Best effort: a worker that has already died sees its pipe close just the same. */
+			try
+			{
+				sendMessage(toWorker[w], string());
+			}
+			catch (exception&)
+			{
+			}
+
+			close(toWorker[w]);
+			close(fromWorker[w]);
+			while (waitpid(pids[w], NULL, 0) < 0 && errno == EINTR)
+				;
+		}
+
+		pids.clear();
+		toWorker.clear();
+		fromWorker.clear();
+	}
+
+	vector<pid_t> pids;
+	vector<int> toWorker, fromWorker;
+};
+
+
+/* Fork the workers into workers, then drive the training iterations. */
+static vector<double> coordinate(DenseModel<double>& model, const vector<Shard>& shards,
+								 int iterations, Workers& workers)
+{
+	vector<int>& toWorker = workers.toWorker;
+	vector<int>& fromWorker = workers.fromWorker;
+
+	for (size_t w = 0; w < shards.size(); ++w)
+	{
+		int down[2], up[2];
+		if (pipe(down) != 0)
+			throw runtime_error("cannot create worker pipes");
+		if (pipe(up) != 0)
+		{
+			close(down[0]);
+			close(down[1]);
+			throw runtime_error("cannot create worker pipes");
+		}
+
+		cout.flush();
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			for (auto fd : {down[0], down[1], up[0], up[1]})
+				close(fd);
+			throw runtime_error("cannot fork worker");
+		}
+
+		if (pid == 0)
+		{
+			/* Drop the pipes of the workers forked before this one. */
+			for (size_t i = 0; i < toWorker.size(); ++i)
+			{
+				close(toWorker[i]);
+				close(fromWorker[i]);
+			}
+			close(down[1]);
+			close(up[0]);
+
+			int status = 0;
+			try
+			{
+				runWorker(model, shards[w], down[0], up[1]);
+			}
+			catch (exception& e)
+			{
+				cerr << "worker " << w << ": " << e.what() << endl;
+				status = 1;
+			}
+			_exit(status);
+		}
+
+		close(down[0]);
+		close(up[1]);
+		workers.pids.push_back(pid);
+		toWorker.push_back(down[1]);
+		fromWorker.push_back(up[0]);
+	}
+
+	vector<double> ret;
+	ExpectedCounts total(model.numStates(), model.numOutputs()), counts;
+	string msg;
+
+	for (int iter = 0; iter < iterations; ++iter)
+	{
+		/* Broadcast the current model. */
+		ostringstream params;
+		model.writeParameters(params);
+		for (auto fd : toWorker)
+			sendMessage(fd, params.str());
+
+		/* Merge the counts of every shard. */
+		total.clear();
+		for (size_t w = 0; w < fromWorker.size(); ++w)
+		{
+			if (!receiveMessage(fromWorker[w], msg))
+				throw runtime_error("worker " + to_string(w) + " exited unexpectedly");
+
+			istringstream in(msg);
+			counts.read(in);
+			total.merge(counts);
+		}
+
+		model.reestimate(total);
+		ret.push_back(total.logLikelihood);
+	}
+
+	return ret;
+}
+
+
+vector<double> trainDistributed(DenseModel<double>& model, const vector<Shard>& shards,
+								int iterations)
+{
+	/* Declared first so that it outlives the workers, whose shutdown still writes to them. */
+	IgnoreSigpipe ignoreSigpipe;
+
+	/* Stop and reap the workers on every way out, even if the exception is never caught. */
+	Workers workers;
+	try
+	{
+		return coordinate(model, shards, iterations, workers);
+	}
+	catch (...)
+	{
+		workers.stop();
+		throw;
+	}
+}
@@ -0,0 +1,31 @@
+#ifndef GUARD_DISTRIBUTED_HPP
+#define GUARD_DISTRIBUTED_HPP
+
+#include <string>
+#include <vector>
+#include "DenseModel.hpp"
+
+
+/**
+ * The observation sequences handled by one worker: every stride-th sequence, starting at offset,
+ * of the concatenation of the given .obs files.
+ */
+struct Shard
+{
+	std::vector<std::string> obsFilenames;
+	size_t offset, stride;
+};
+
+/**
+ * Data-parallel Baum-Welch. Forks one worker process per shard, each of which loads its own
+ * sequences. Every iteration the coordinator sends the current parameters down a pipe to each
+ * worker, the workers run the E-step on their shards and send back their ExpectedCounts, and the
+ * coordinator merges those and runs the M-step on model.
+ *
+ * Returns the total log-likelihood measured by the E-step of each iteration.
+ */
+std::vector<double> trainDistributed(DenseModel<double>& model, const std::vector<Shard>& shards,
+									 int iterations);
+
+
+#endif
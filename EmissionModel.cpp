@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include "EmissionModel.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+
+static const uint32_t FEATURES_MAGIC = 0x484d4d46;	// "HMMF"
+
+
+vector<FeatureSequence> readFeatureFile(const string& filename)
+{
+	ifstream file(filename, ios::binary);
+	if (!file.is_open())
+		throw runtime_error("file not found: " + filename);
+
+	uint32_t header[3];
+	file.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!file || header[0] != FEATURES_MAGIC)
+		throw runtime_error("not a feature file: " + filename);
+
+	vector<FeatureSequence> ret(header[2], FeatureSequence(header[1]));
+
+	for (auto& seq : ret)
+	{
+		uint64_t T = 0;
+		file.read(reinterpret_cast<char*>(&T), sizeof(T));
+		seq.frames.resize(T*seq.dimension);
+		file.read(reinterpret_cast<char*>(seq.frames.data()), seq.frames.size()*sizeof(float));
+
+		if (!file)
+			throw runtime_error("truncated feature file: " + filename);
+	}
+	return ret;
+}
+
+
+void writeFeatureFile(const string& filename, const vector<FeatureSequence>& sequences)
+{
+	ofstream file(filename, ios::binary);
+	if (!file.is_open())
+		throw runtime_error("cannot create file: " + filename);
+
+	uint32_t D = sequences.empty() ? 0 : sequences[0].dimension;
+	uint32_t header[3] = {FEATURES_MAGIC, D, uint32_t(sequences.size())};
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+	for (auto& seq : sequences)
+	{
+		if (seq.dimension != D)
+			throw runtime_error("feature sequences differ in dimension");
+
+		uint64_t T = seq.length();
+		file.write(reinterpret_cast<const char*>(&T), sizeof(T));
+		file.write(reinterpret_cast<const char*>(seq.frames.data()), seq.frames.size()*sizeof(float));
+	}
+
+	file.close();
+	if (!file)
+		throw runtime_error("cannot write feature file: " + filename);
+}
+
+
+unique_ptr<EmissionModel> readEmissionModel(istream& in, const string& tag, size_t N, size_t D)
+{
+	if (tag == "gmm:")
+		return unique_ptr<EmissionModel>(new GaussianMixture(in, N, D));
+
+	throw runtime_error("unknown emission block: " + tag);
+}
+
+
+GaussianMixture::GaussianMixture(istream& in, size_t N, size_t D, double varianceFloor)
+	: _dimension(D), _varianceFloor(varianceFloor)
+{
+	string line;
+	_componentStart.push_back(0);
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		if (!getline(in, line))
+			throw runtime_error("truncated gmm: block");
+
+		int K = strtol(line.c_str(), NULL, 10);
+		if (K <= 0)
+			throw runtime_error("every state needs at least one mixture component");
+
+		for (int k = 0; k < K; ++k)
+		{
+			if (!getline(in, line))
+				throw runtime_error("truncated gmm: block");
+
+			vector<double> values = split<double>(line);
+			if (values.size() != 1 + 2*D)
+				throw runtime_error("mixture components need a weight, " + to_string(D)
+									+ " means and " + to_string(D) + " variances");
+
+			_weights.push_back(values[0]);
+			_means.insert(_means.end(), &values[1], &values[1] + D);
+			_variances.insert(_variances.end(), &values[1+D], &values[1+D] + D);
+		}
+		_componentStart.push_back(_weights.size());
+	}
+
+	for (auto var : _variances)
+		if (var <= 0)
+			throw runtime_error("mixture variances must be positive");
+
+	_occupancy.resize(numComponents());
+	_sums.resize(numComponents()*D);
+	_squares.resize(numComponents()*D);
+
+	prepare();
+}
+
+
+void GaussianMixture::prepare()
+{
+	size_t C = numComponents(), D = _dimension;
+
+	_constants.assign(C, 0);
+	_centers.assign(D*C, 0);
+	_scales.assign(D*C, 0);
+
+	for (size_t c = 0; c < C; ++c)
+	{
+		double g = log(_weights[c]);
+		for (size_t d = 0; d < D; ++d)
+		{
+			double var = _variances[c*D + d];
+			g -= 0.5 * log(2*M_PI*var);
+
+			_centers[d*C + c] = _means[c*D + d];
+			_scales[d*C + c] = -0.5 / var;
+		}
+		_constants[c] = g;
+	}
+}
+
+
+/* Log of weight times density for all components at frame x, one dimension at a time. */
+void GaussianMixture::componentScores(const float* x, double* scores) const
+{
+	size_t C = numComponents(), D = _dimension;
+	copy(_constants.begin(), _constants.end(), scores);
+
+	for (size_t d = 0; d < D; ++d)
+	{
+		const double* centers = &_centers[d*C];
+		const double* scales = &_scales[d*C];
+		double xd = x[d];
+
+		for (size_t c = 0; c < C; ++c)
+		{
+			double diff = xd - centers[c];
+			scores[c] += scales[c]*diff*diff;
+		}
+	}
+}
+
+
+/* log sum_c exp(scores[c]) over [begin, end), shifted by the largest score. */
+static double logSum(const double* begin, const double* end)
+{
+	double peak = *max_element(begin, end);
+	if (peak == -numeric_limits<double>::infinity())
+		return peak;
+
+	double sum = 0;
+	for (const double* s = begin; s != end; ++s)
+		sum += exp(*s - peak);
+	return peak + log(sum);
+}
+
+
+void GaussianMixture::logDensities(const FeatureSequence& obs, vector<double>& out) const
+{
+	if (obs.dimension != _dimension)
+		throw runtime_error("feature dimension does not match the model");
+
+	size_t N = numStates(), T = obs.length();
+	vector<double> scores(numComponents());
+	out.resize(T*N);
+
+	for (size_t t = 0; t < T; ++t)
+	{
+		componentScores(obs.frame(t), scores.data());
+
+		for (size_t i = 0; i < N; ++i)
+			out[t*N + i] = logSum(&scores[_componentStart[i]], &scores[_componentStart[i+1]]);
+	}
+}
+
+
+/* One component at a time, straight from the parameters. */
+double GaussianMixture::logDensity(size_t i, const float* x) const
+{
+	size_t D = _dimension;
+	vector<double> scores;
+
+	for (size_t c = _componentStart[i]; c < _componentStart[i+1]; ++c)
+	{
+		double score = log(_weights[c]);
+		for (size_t d = 0; d < D; ++d)
+		{
+			double var = _variances[c*D + d], diff = x[d] - _means[c*D + d];
+			score -= 0.5 * (log(2*M_PI*var) + diff*diff/var);
+		}
+		scores.push_back(score);
+	}
+
+	return logSum(scores.data(), scores.data() + scores.size());
+}
+
+
+/* Split each state's posterior among its components in proportion to their scores. */
+void GaussianMixture::accumulate(const FeatureSequence& obs, const vector<double>& gamma)
+{
+	if (obs.dimension != _dimension)
+		throw runtime_error("feature dimension does not match the model");
+
+	size_t N = numStates(), D = _dimension, T = obs.length();
+	vector<double> scores(numComponents());
+
+	for (size_t t = 0; t < T; ++t)
+	{
+		const float* x = obs.frame(t);
+		componentScores(x, scores.data());
+
+		for (size_t i = 0; i < N; ++i)
+		{
+			double g = gamma[t*N + i];
+			if (g <= 0)
+				continue;
+
+			double total = logSum(&scores[_componentStart[i]], &scores[_componentStart[i+1]]);
+
+			for (size_t c = _componentStart[i]; c < _componentStart[i+1]; ++c)
+			{
+				double post = g * exp(scores[c] - total);
+				_occupancy[c] += post;
+
+				for (size_t d = 0; d < D; ++d)
+				{
+					double diff = x[d] - _means[c*D + d];
+					_sums[c*D + d] += post * diff;
+					_squares[c*D + d] += post * diff*diff;
+				}
+			}
+		}
+	}
+}
+
+
+void GaussianMixture::reestimate()
+{
+	size_t N = numStates(), D = _dimension;
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		double total = 0;
+		for (size_t c = _componentStart[i]; c < _componentStart[i+1]; ++c)
+			total += _occupancy[c];
+		if (total <= 0)
+			continue;
+
+		/* A component that took no frames drops out of the mixture but keeps its shape. */
+		for (size_t c = _componentStart[i]; c < _componentStart[i+1]; ++c)
+		{
+			_weights[c] = _occupancy[c] / total;
+			if (_occupancy[c] <= 0)
+				continue;
+
+			for (size_t d = 0; d < D; ++d)
+			{
+				double shift = _sums[c*D + d] / _occupancy[c];
+				double var = _squares[c*D + d] / _occupancy[c] - shift*shift;
+
+				_means[c*D + d] += shift;
+				_variances[c*D + d] = max(var, _varianceFloor);
+			}
+		}
+	}
+
+	fill(_occupancy.begin(), _occupancy.end(), 0.0);
+	fill(_sums.begin(), _sums.end(), 0.0);
+	fill(_squares.begin(), _squares.end(), 0.0);
+
+	prepare();
+}
+
+
+void GaussianMixture::write(ostream& out) const
+{
+	size_t N = numStates(), D = _dimension;
+	out << "gmm:" << endl;
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		out << _componentStart[i+1] - _componentStart[i] << endl;
+
+		for (size_t c = _componentStart[i]; c < _componentStart[i+1]; ++c)
+		{
+			out << _weights[c];
+			for (size_t d = 0; d < D; ++d)
+				out << " " << _means[c*D + d];
+			for (size_t d = 0; d < D; ++d)
+				out << " " << _variances[c*D + d];
+			out << endl;
+		}
+	}
+}
@@ -0,0 +1,146 @@
+#ifndef GUARD_EMISSION_MODEL_HPP
+#define GUARD_EMISSION_MODEL_HPP
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/**
+ * A sequence of T feature vectors of the same dimension D, stored frame after frame.
+ */
+struct FeatureSequence
+{
+	FeatureSequence(size_t dim = 0) : dimension(dim) {}
+
+	size_t length() const { return dimension ? frames.size() / dimension : 0; }
+	const float* frame(size_t t) const { return &frames[t*dimension]; }
+
+	size_t dimension;
+	std::vector<float> frames;	// T x D
+};
+
+
+/**
+ * Read a binary feature file: magic "HMMF", the dimension D and the number of sequences as
+ * uint32, then for every sequence its length T as uint64 followed by T x D floats. All values
+ * are in host byte order.
+ */
+std::vector<FeatureSequence> readFeatureFile(const std::string& filename);
+/**
+ * Write sequences, which must share one dimension, in the format read by readFeatureFile().
+ */
+void writeFeatureFile(const std::string& filename, const std::vector<FeatureSequence>& sequences);
+
+
+/**
+ * Emission densities of the states of a continuous HMM. Implementations score all frames of a
+ * sequence for all states in one pass, before any trellis is run, and keep the statistics of the
+ * E-step themselves, since what they need differs from one family of densities to the next.
+ */
+class EmissionModel
+{
+public:
+	virtual ~EmissionModel() {}
+
+	virtual size_t numStates() const = 0;
+	virtual size_t dimension() const = 0;
+
+	/**
+	 * Fill out, T x N frame after frame, with the log-densities log b_i(x_t) of every frame t
+	 * of obs for every state i.
+	 */
+	virtual void logDensities(const FeatureSequence& obs, std::vector<double>& out) const = 0;
+	/**
+	 * Returns log b_i(x) of a single frame, evaluated directly rather than in a batched pass.
+	 * Slow; meant for checking logDensities().
+	 */
+	virtual double logDensity(size_t i, const float* x) const = 0;
+
+	/**
+	 * Baum-Welch E-step: add the statistics of obs, given the state posteriors gamma (T x N,
+	 * frame after frame).
+	 */
+	virtual void accumulate(const FeatureSequence& obs, const std::vector<double>& gamma) = 0;
+	/**
+	 * Baum-Welch M-step: re-estimate the densities from the statistics added since the last
+	 * call, and clear them. States without statistics keep their densities.
+	 */
+	virtual void reestimate() = 0;
+
+	/**
+	 * Write the densities as the block of an .hmm file, starting with its tag line.
+	 */
+	virtual void write(std::ostream& out) const = 0;
+};
+
+
+/**
+ * Read the emission block of an .hmm file whose tag line was tag, for N states of dimension D.
+ * Known tags are "gmm:" for GaussianMixture.
+ */
+std::unique_ptr<EmissionModel> readEmissionModel(std::istream& in, const std::string& tag,
+												 size_t N, size_t D);
+
+
+/**
+ * Mixtures of Gaussians with diagonal covariance, one mixture per state. The block is
+ *
+ *     gmm:
+ *     for every state, a line with its number of components K, then K lines of
+ *     weight, D means and D variances
+ *
+ * Each component's log-density is scored as
+ *
+ *     log w + log N(x; mu, var) = g - sum_d (x_d - mu_d)^2 / (2 var_d)
+ *
+ * in double, subtracting the mean before squaring. Expanding the square into terms in x and x^2
+ * would be cheaper, but those terms cancel and lose all precision once the means are large
+ * against the deviations, as they are for raw sensor readings. The means and scales of all
+ * components are kept dimension-major, so that scoring a frame is a sequence of contiguous
+ * loops across all components, which the compiler vectorizes.
+ */
+class GaussianMixture : public EmissionModel
+{
+public:
+	/**
+	 * @param varianceFloor lower bound on re-estimated variances
+	 */
+	GaussianMixture(std::istream& in, size_t N, size_t D, double varianceFloor = 1e-3);
+
+	size_t numStates() const { return _componentStart.size() - 1; }
+	size_t dimension() const { return _dimension; }
+	size_t numComponents() const { return _weights.size(); }
+
+	void logDensities(const FeatureSequence& obs, std::vector<double>& out) const;
+	double logDensity(size_t i, const float* x) const;
+	void accumulate(const FeatureSequence& obs, const std::vector<double>& gamma);
+	void reestimate();
+	void write(std::ostream& out) const;
+
+private:
+	void prepare();
+	void componentScores(const float* x, double* scores) const;
+
+	size_t _dimension;
+	double _varianceFloor;
+
+	/* Components of state i are [_componentStart[i], _componentStart[i+1]). */
+	std::vector<size_t> _componentStart;
+	std::vector<double> _weights;			// C
+	std::vector<double> _means, _variances;	// C x D
+
+	/* Scoring coefficients, derived from the parameters by prepare(). */
+	std::vector<double> _constants;				// C
+	std::vector<double> _centers, _scales;		// D x C, mu_d and -1 / (2 var_d)
+
+	/* E-step statistics: occupancy, and sums of x - mu and (x - mu)^2 weighted by it, taken about
+	 * the current means so that the variance does not come from a difference of large sums. */
+	std::vector<double> _occupancy;			// C
+	std::vector<double> _sums, _squares;	// C x D
+};
+
+
+#endif
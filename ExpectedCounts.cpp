@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include "ExpectedCounts.hpp"
+
+using namespace std;
+
+
+/* Identifies a serialized set of counts, and catches byte order mismatches between hosts. */
+static const uint32_t COUNTS_MAGIC = 0x484d4d43;	// "HMMC"
+
+
+ExpectedCounts::ExpectedCounts(size_t N, size_t M)
+	: numStates(N), numOutputs(M), sequences(0), logLikelihood(0),
+	  transitions(N*N), emissions(N*M), initStates(N)
+{
+}
+
+
+void ExpectedCounts::merge(const ExpectedCounts& other)
+{
+	if (other.numStates != numStates || other.numOutputs != numOutputs)
+		throw runtime_error("cannot merge counts of differently sized models");
+
+	sequences += other.sequences;
+	logLikelihood += other.logLikelihood;
+
+	for (size_t i = 0; i < transitions.size(); ++i)
+		transitions[i] += other.transitions[i];
+	for (size_t i = 0; i < emissions.size(); ++i)
+		emissions[i] += other.emissions[i];
+	for (size_t i = 0; i < initStates.size(); ++i)
+		initStates[i] += other.initStates[i];
+}
+
+
+void ExpectedCounts::clear()
+{
+	sequences = 0;
+	logLikelihood = 0;
+
+	fill(transitions.begin(), transitions.end(), 0.0);
+	fill(emissions.begin(), emissions.end(), 0.0);
+	fill(initStates.begin(), initStates.end(), 0.0);
+}
+
+
+void ExpectedCounts::interpolate(const ExpectedCounts& other, double weight)
+{
+	if (other.numStates != numStates || other.numOutputs != numOutputs)
+		throw runtime_error("cannot interpolate counts of differently sized models");
+
+	double keep = 1 - weight;
+	logLikelihood = keep*logLikelihood + weight*other.logLikelihood;
+
+	for (size_t i = 0; i < transitions.size(); ++i)
+		transitions[i] = keep*transitions[i] + weight*other.transitions[i];
+	for (size_t i = 0; i < emissions.size(); ++i)
+		emissions[i] = keep*emissions[i] + weight*other.emissions[i];
+	for (size_t i = 0; i < initStates.size(); ++i)
+		initStates[i] = keep*initStates[i] + weight*other.initStates[i];
+}
+
+
+/* Layout: magic, N, M (uint32), sequences (uint64), log-likelihood, then the transition, emission
+ * and initial state counts as raw doubles. */
+void ExpectedCounts::write(ostream& out) const
+{
+	uint32_t header[3] = {COUNTS_MAGIC, uint32_t(numStates), uint32_t(numOutputs)};
+	uint64_t seqs = sequences;
+
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(&seqs), sizeof(seqs));
+	out.write(reinterpret_cast<const char*>(&logLikelihood), sizeof(logLikelihood));
+	out.write(reinterpret_cast<const char*>(transitions.data()), transitions.size()*sizeof(double));
+	out.write(reinterpret_cast<const char*>(emissions.data()), emissions.size()*sizeof(double));
+	out.write(reinterpret_cast<const char*>(initStates.data()), initStates.size()*sizeof(double));
+
+	if (!out)
+		throw runtime_error("cannot write expected counts");
+}
+
+
+void ExpectedCounts::read(istream& in)
+{
+	uint32_t header[3];
+	uint64_t seqs;
+
+	in.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!in || header[0] != COUNTS_MAGIC)
+		throw runtime_error("not a set of expected counts");
+
+	*this = ExpectedCounts(header[1], header[2]);
+
+	in.read(reinterpret_cast<char*>(&seqs), sizeof(seqs));
+	in.read(reinterpret_cast<char*>(&logLikelihood), sizeof(logLikelihood));
+	in.read(reinterpret_cast<char*>(transitions.data()), transitions.size()*sizeof(double));
+	in.read(reinterpret_cast<char*>(emissions.data()), emissions.size()*sizeof(double));
+	in.read(reinterpret_cast<char*>(initStates.data()), initStates.size()*sizeof(double));
+
+	if (!in)
+		throw runtime_error("truncated expected counts");
+
+	sequences = seqs;
+}
@@ -0,0 +1,40 @@
+#ifndef GUARD_EXPECTED_COUNTS_HPP
+#define GUARD_EXPECTED_COUNTS_HPP
+
+#include <iosfwd>
+#include <vector>
+
+
+/**
+ * Baum-Welch sufficient statistics: the expected number of transitions, emissions and initial
+ * states summed over a set of observation sequences (the numerators of Rabiner eq. 40a-c). The
+ * denominators are the row sums, so counts from disjoint sets of sequences merge by addition.
+ */
+struct ExpectedCounts
+{
+	ExpectedCounts() : numStates(0), numOutputs(0), sequences(0), logLikelihood(0) {}
+	ExpectedCounts(size_t N, size_t M);
+
+	/** Add the counts of another set of sequences to these. */
+	void merge(const ExpectedCounts& other);
+	/** Reset all counts to zero, keeping the dimensions. */
+	void clear();
+	/** Replace these counts by (1 - weight) * these + weight * other. */
+	void interpolate(const ExpectedCounts& other, double weight);
+
+	/** Write these counts in a compact binary format. */
+	void write(std::ostream& out) const;
+	/** Replace these counts by ones written with write(). */
+	void read(std::istream& in);
+
+	size_t numStates, numOutputs;
+	size_t sequences;		// number of sequences with non-zero probability
+	double logLikelihood;	// total log-likelihood of those sequences
+
+	std::vector<double> transitions;	// N x N
+	std::vector<double> emissions;		// N x M
+	std::vector<double> initStates;		// N
+};
+
+
+#endif
@@ -2,6 +2,7 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include "DenseModel.hpp"
 #include "HiddenMarkovModel.hpp"
 #include "Utils.hpp"
 
@@ -359,6 +360,25 @@ vector<pair<double, vector<string> > > HiddenMarkovModel::viterbi(const string&
 }
 
 
+vector<vector<pair<double, vector<string> > > > HiddenMarkovModel::nbest(const string& filename,
+																		 size_t K)
+{
+	vector<vector<string> > observations = parseObsFile(filename);
+	if (observations.empty())
+		throw runtime_error("observation file is empty");
+
+	/* The list Viterbi decoder lives in the dense model. */
+	DenseModel<double> model(*this);
+	vector<vector<pair<double, vector<string> > > > ret;
+
+	/* Iterate through each sequence of observations. */
+	for (auto obs : observations)
+		ret.push_back(model.nbest(obs, K));
+
+	return ret;
+}
+
+
 void HiddenMarkovModel::optimized(const string& obsFilename, const string& optFilename)
 {
 	vector<vector<string> > observations = parseObsFile(obsFilename);
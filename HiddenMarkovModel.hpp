@@ -67,6 +67,12 @@ public:
 	 * for each observation sequence in a given .obs file.
 	 */
 	std::vector<std::pair<double, std::vector<std::string> > > viterbi(const std::string& filename);
+	/**
+	 * Returns the K most likely state paths, best first, with their log-probabilities for each
+	 * observation sequence in a given .obs file.
+	 */
+	std::vector<std::vector<std::pair<double, std::vector<std::string> > > >
+		nbest(const std::string& filename, size_t K);
 	/**
 	 * Writes an optimized HMM with respect to a given observation sequence in an .obs file.
 	 */
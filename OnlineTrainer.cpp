@@ -0,0 +1,182 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include "OnlineTrainer.hpp"
+
+using namespace std;
+
+
+static const uint32_t CHECKPOINT_MAGIC = 0x484d4d4f;	// "HMMO"
+
+
+OnlineTrainer::OnlineTrainer(DenseModel<double>& model, size_t batchSize, double kappa,
+							 double offset)
+	: _model(model), _stats(model.numStates(), model.numOutputs()),
+	  _batch(model.numStates(), model.numOutputs()),
+	  _batchSize(batchSize), _pending(0), _updates(0), _skipped(0),
+	  _kappa(kappa), _offset(offset), _lastLogLikelihood(0)
+{
+	if (batchSize == 0)
+		throw runtime_error("mini-batch size must be positive");
+	if (offset <= 0)
+		throw runtime_error("step size offset must be positive");
+}
+
+
+double OnlineTrainer::add(const vector<string>& obs)
+{
+	/* Sequences the model cannot produce, including those with outputs it does not know, add no
+	 * counts, but still take their place in the batch so that update latency does not depend on
+	 * the data. One bad line must not end a long-running stream. */
+	vector<int> encoded;
+	bool known = true;
+	try
+	{
+		encoded = _model.encode(obs);
+	}
+	catch (const runtime_error&)
+	{
+		known = false;
+	}
+
+	double logProb = known ? _model.accumulate(encoded, _batch)
+						   : -numeric_limits<double>::infinity();
+
+	if (std::isinf(logProb))
+		++_skipped;
+
+	if (++_pending == _batchSize)
+		flush();
+	return logProb;
+}
+
+
+void OnlineTrainer::flush()
+{
+	if (_pending == 0)
+		return;
+
+	if (_batch.sequences > 0)
+	{
+		/* Average the batch counts per sequence by blending them into zero counts. */
+		ExpectedCounts average(_model.numStates(), _model.numOutputs());
+		average.interpolate(_batch, 1.0 / _batch.sequences);
+
+		if (_updates == 0)
+			seed(average);
+
+		double eta = pow(1 + (_updates + 1) / _offset, -_kappa);
+		_stats.interpolate(average, eta);
+		_stats.sequences = 1;
+
+		_model.reestimate(_stats);
+		_lastLogLikelihood = average.logLikelihood;
+		++_updates;
+	}
+
+	_batch.clear();
+	_pending = 0;
+}
+
+
+/* Until the first update, stand in the initial model for the running statistics, weighted like
+ * the first batch average: each row of A and B carries that batch's occupancy of its state, and
+ * pi one sequence. Since no step size reaches one, outputs and transitions that the first batch
+ * lacks keep part of their probability rather than dropping to zero, from which EM could never
+ * bring them back. */
+void OnlineTrainer::seed(const ExpectedCounts& average)
+{
+	size_t N = _model.numStates(), M = _model.numOutputs();
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		double occupancy = 0;
+		for (size_t j = 0; j < N; ++j)
+			occupancy += average.transitions[i*N + j];
+		for (size_t j = 0; j < N; ++j)
+			_stats.transitions[i*N + j] = _model.transition(i, j) * occupancy;
+
+		occupancy = 0;
+		for (size_t o = 0; o < M; ++o)
+			occupancy += average.emissions[i*M + o];
+		for (size_t o = 0; o < M; ++o)
+			_stats.emissions[i*M + o] = _model.emission(i, o) * occupancy;
+
+		_stats.initStates[i] = _model.initState(i);
+	}
+
+	_stats.logLikelihood = average.logLikelihood;
+}
+
+
+/* Layout: magic, update count (uint64), kappa and offset (double), batch size (uint64), the
+ * running statistics as written by ExpectedCounts, then the model parameters as written by
+ * DenseModel. */
+void OnlineTrainer::checkpoint(const string& filename) const
+{
+	string tmpFilename = filename + ".tmp";
+	{
+		ofstream file(tmpFilename, ios::binary);
+		if (!file.is_open())
+			throw runtime_error("cannot create file: " + tmpFilename);
+
+		uint32_t magic = CHECKPOINT_MAGIC;
+		uint64_t updates = _updates, batchSize = _batchSize;
+		file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+		file.write(reinterpret_cast<const char*>(&updates), sizeof(updates));
+		file.write(reinterpret_cast<const char*>(&_kappa), sizeof(_kappa));
+		file.write(reinterpret_cast<const char*>(&_offset), sizeof(_offset));
+		file.write(reinterpret_cast<const char*>(&batchSize), sizeof(batchSize));
+		_stats.write(file);
+		_model.writeParameters(file);
+
+		file.close();
+		if (!file)
+			throw runtime_error("cannot write checkpoint: " + tmpFilename);
+	}
+
+	if (rename(tmpFilename.c_str(), filename.c_str()) != 0)
+		throw runtime_error("cannot replace checkpoint: " + filename);
+}
+
+
+void OnlineTrainer::restore(const string& filename)
+{
+	ifstream file(filename, ios::binary);
+	if (!file.is_open())
+		throw runtime_error("file not found: " + filename);
+
+	uint32_t magic = 0;
+	uint64_t updates = 0, batchSize = 0;
+	double kappa = 0, offset = 0;
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	file.read(reinterpret_cast<char*>(&updates), sizeof(updates));
+	file.read(reinterpret_cast<char*>(&kappa), sizeof(kappa));
+	file.read(reinterpret_cast<char*>(&offset), sizeof(offset));
+	file.read(reinterpret_cast<char*>(&batchSize), sizeof(batchSize));
+	if (!file || magic != CHECKPOINT_MAGIC)
+		throw runtime_error("not an online training checkpoint: " + filename);
+
+	if (kappa != _kappa || offset != _offset || batchSize != _batchSize)
+	{
+		ostringstream settings;
+		settings << "kappa " << kappa << ", offset " << offset << ", batch size " << batchSize;
+		throw runtime_error("checkpoint was written with " + settings.str() + ": " + filename);
+	}
+
+	ExpectedCounts stats;
+	stats.read(file);
+	if (stats.numStates != _model.numStates() || stats.numOutputs != _model.numOutputs())
+		throw runtime_error("checkpoint does not match the model: " + filename);
+
+	_model.readParameters(file);
+	_stats = stats;
+	_updates = updates;
+
+	_batch.clear();
+	_pending = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef GUARD_ONLINE_TRAINER_HPP
+#define GUARD_ONLINE_TRAINER_HPP
+
+#include <string>
+#include <vector>
+#include "DenseModel.hpp"
+#include "ExpectedCounts.hpp"
+
+
+/**
+ * Stepwise online EM (Cappe & Moulines, 2009; Liang & Klein, 2009). The trainer keeps a running
+ * average of per-sequence expected counts, which starts out as the initial model. After every
+ * mini-batch it blends in the batch average with step size eta_k = (1 + (k + 1) / offset)^-kappa,
+ * k being the number of earlier updates, and re-estimates A, B and pi from the result. Memory and
+ * the cost of an update depend only on the model size and the batch, never on how many sequences
+ * have been seen.
+ */
+class OnlineTrainer
+{
+public:
+	/**
+	 * @param model the model to adapt in place
+	 * @param batchSize number of sequences per update
+	 * @param kappa step size decay, in (0.5, 1] for convergence
+	 * @param offset number of updates over which the step size stays close to one
+	 */
+	OnlineTrainer(DenseModel<double>& model, size_t batchSize, double kappa = 0.7,
+				  double offset = 4);
+
+	/**
+	 * Run the E-step on one sequence, and update the model if this completes a mini-batch.
+	 * Returns the log-likelihood of the sequence under the model before the update, which is
+	 * -infinity for sequences with outputs the model does not know.
+	 */
+	double add(const std::vector<std::string>& obs);
+	/**
+	 * Update the model from a partially filled mini-batch. Does nothing if it is empty.
+	 */
+	void flush();
+
+	/** Returns the number of model updates made so far. */
+	size_t updates() const { return _updates; }
+	/** Returns the average log-likelihood of the sequences of the last mini-batch. */
+	double lastLogLikelihood() const { return _lastLogLikelihood; }
+	/**
+	 * Returns the number of sequences the model could not produce, unknown outputs included,
+	 * which added no counts.
+	 */
+	size_t skipped() const { return _skipped; }
+
+	/**
+	 * Write the running statistics, the update count, the step size schedule and batch size,
+	 * and the model parameters to filename. The file is replaced atomically, so a crash leaves
+	 * the previous checkpoint intact.
+	 */
+	void checkpoint(const std::string& filename) const;
+	/**
+	 * Resume from a checkpoint written by checkpoint(). Discards the current mini-batch. Throws
+	 * if the checkpoint was written with another kappa, offset or batch size, since resuming
+	 * would silently change the step size schedule.
+	 */
+	void restore(const std::string& filename);
+
+private:
+	void seed(const ExpectedCounts& average);
+
+	DenseModel<double>& _model;
+	ExpectedCounts _stats, _batch;
+	size_t _batchSize, _pending, _updates, _skipped;
+	double _kappa, _offset, _lastLogLikelihood;
+};
+
+
+#endif
@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include "HiddenMarkovModel.hpp"
+#include "SecondOrderModel.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+
+SecondOrderModel::SecondOrderModel(const string& filename) : _beam(0)
+{
+	/* The first-order part reads like any other .hmm file. */
+	HiddenMarkovModel hmm(filename);
+	DenseModel<double> first(hmm);
+
+	_numOfTimeSteps = hmm.timeSteps();
+	_stateNames = hmm.states();
+	_outputNames = hmm.outputs();
+
+	size_t N = numStates(), M = numOutputs();
+
+	for (size_t o = 0; o < M; ++o)
+		_outputIndex[_outputNames[o]] = o;
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		for (size_t j = 0; j < N; ++j)
+			_transitions.push_back(first.transition(i, j));
+		for (size_t o = 0; o < M; ++o)
+			_emissions.push_back(first.emission(i, o));
+		_initStates.push_back(first.initState(i));
+	}
+
+	ifstream file(filename);
+	if (!file.is_open())
+		throw runtime_error("file not found: " + string(filename));
+
+	/* Look for the optional "a2:" block after the first-order part. */
+	string line;
+	bool found = false;
+	while (!found && getline(file, line))
+		found = (split<string>(line) == vector<string>(1, "a2:"));
+
+	/* Keep the non-zero entries of every row (i, j); without a block, use row j of A. */
+	_rowStart.push_back(0);
+	for (size_t p = 0; p < N*N; ++p)
+	{
+		vector<double> row;
+		if (found)
+		{
+			if (!getline(file, line))
+				throw runtime_error("truncated a2: block in " + filename);
+			row = split<double>(line);
+			if (row.size() != N)
+				throw runtime_error("a2: rows need " + to_string(N) + " entries in " + filename);
+		}
+		else
+			row.assign(&_transitions[(p % N)*N], &_transitions[(p % N)*N] + N);
+
+		for (size_t k = 0; k < N; ++k)
+			if (row[k] > 0)
+			{
+				_next.push_back(k);
+				_probs.push_back(row[k]);
+			}
+		_rowStart.push_back(_probs.size());
+	}
+}
+
+
+vector<int> SecondOrderModel::encode(const vector<string>& obs) const
+{
+	vector<int> ret;
+	ret.reserve(obs.size());
+
+	for (auto out : obs)
+	{
+		auto it = _outputIndex.find(out);
+		if (it == _outputIndex.end())
+			throw runtime_error("No such output: " + out);
+
+		ret.push_back(it->second);
+	}
+	return ret;
+}
+
+
+/* The first pair column, (s_0, s_1): pi_j * b_j(o_0) * a_jk * b_k(o_1). */
+double SecondOrderModel::initColumn(const vector<int>& obs, bool maxProduct, Column& col,
+									Scratch& scratch) const
+{
+	size_t N = numStates();
+	col.pairs.clear();
+
+	for (size_t j = 0; j < N; ++j)
+	{
+		double start = _initStates[j] * emission(j, obs[0]);
+		if (start == 0)
+			continue;
+
+		for (size_t k = 0; k < N; ++k)
+		{
+			double v = start * _transitions[j*N + k] * emission(k, obs[1]);
+			if (v == 0)
+				continue;
+
+			scratch.values[j*N + k] = v;
+			scratch.from[j*N + k] = j;
+			col.pairs.push_back(j*N + k);
+		}
+	}
+
+	return finishColumn(maxProduct, col, scratch);
+}
+
+
+/* Extend every live pair (i, j) of prev by the states k it can move to, into pairs (j, k). */
+double SecondOrderModel::advance(const Column& prev, int o, bool maxProduct, Column& next,
+								 Scratch& scratch) const
+{
+	size_t N = numStates();
+	next.pairs.clear();
+
+	for (size_t n = 0; n < prev.pairs.size(); ++n)
+	{
+		int p = prev.pairs[n], i = p / N, j = p % N;
+		double v = prev.values[n];
+
+		for (size_t e = _rowStart[p]; e < _rowStart[p+1]; ++e)
+		{
+			int k = _next[e];
+			double b = emission(k, o);
+			if (b == 0)
+				continue;
+
+			int q = j*N + k;
+			double curr = v * _probs[e] * b;
+			double& slot = scratch.values[q];
+
+			if (slot == 0 && curr > 0)
+				next.pairs.push_back(q);
+
+			if (maxProduct)
+			{
+				if (curr > slot)
+				{
+					slot = curr;
+					scratch.from[q] = i;
+				}
+			}
+			else
+				slot += curr;
+		}
+	}
+
+	return finishColumn(maxProduct, next, scratch);
+}
+
+
+/* Move the touched scratch entries into the column in pair order, rescaled to sum (or peak) at
+ * one and pruned to the beam, and clear the scratch. Returns the scale, or 0 if nothing lives. */
+double SecondOrderModel::finishColumn(bool maxProduct, Column& col, Scratch& scratch) const
+{
+	/* Sorting costs more than a scan once a good part of the N^2 pairs is live. */
+	size_t NN = scratch.values.size();
+	if (col.pairs.size() < NN / 16)
+		sort(col.pairs.begin(), col.pairs.end());
+	else
+	{
+		col.pairs.clear();
+		for (size_t p = 0; p < NN; ++p)
+			if (scratch.values[p] > 0)
+				col.pairs.push_back(p);
+	}
+
+	double scale = 0, peak = 0;
+	for (auto p : col.pairs)
+	{
+		scale = maxProduct ? max(scale, scratch.values[p]) : scale + scratch.values[p];
+		peak = max(peak, scratch.values[p]);
+	}
+
+	vector<int> pairs;
+	col.values.clear();
+	col.from.clear();
+
+	for (auto p : col.pairs)
+	{
+		if (scratch.values[p] > 0 && scratch.values[p] >= _beam * peak)
+		{
+			pairs.push_back(p);
+			col.values.push_back(scratch.values[p] / scale);
+			col.from.push_back(scratch.from[p]);
+		}
+		scratch.values[p] = 0;
+	}
+
+	col.pairs.swap(pairs);
+	return scale;
+}
+
+
+double SecondOrderModel::logLikelihood(const vector<int>& obs) const
+{
+	if (obs.empty())
+		return 0;
+
+	size_t N = numStates();
+
+	if (obs.size() == 1)
+	{
+		double sum = 0;
+		for (size_t j = 0; j < N; ++j)
+			sum += _initStates[j] * emission(j, obs[0]);
+		return log(sum);
+	}
+
+	Scratch scratch = {vector<double>(N*N), vector<int>(N*N)};
+	Column col, next;
+
+	double scale = initColumn(obs, false, col, scratch);
+	double logProb = log(scale);
+
+	for (size_t t = 2; t < obs.size() && scale > 0; ++t)
+	{
+		scale = advance(col, obs[t], false, next, scratch);
+		logProb += log(scale);
+		swap(col, next);
+	}
+
+	return (scale > 0) ? logProb : -numeric_limits<double>::infinity();
+}
+
+
+pair<double, vector<int> > SecondOrderModel::viterbi(const vector<int>& obs) const
+{
+	if (obs.empty())
+		return make_pair(0.0, vector<int>());
+
+	size_t N = numStates(), T = obs.size();
+
+	if (T == 1)
+	{
+		double best = 0;
+		int bestStt = 0;
+		for (size_t j = 0; j < N; ++j)
+			if (_initStates[j] * emission(j, obs[0]) > best)
+			{
+				best = _initStates[j] * emission(j, obs[0]);
+				bestStt = j;
+			}
+
+		if (best == 0)
+			return make_pair(-numeric_limits<double>::infinity(), vector<int>());
+		return make_pair(log(best), vector<int>(1, bestStt));
+	}
+
+	/* Keep every column for the back trace; they are as sparse as the pruned trellis. */
+	Scratch scratch = {vector<double>(N*N), vector<int>(N*N)};
+	vector<Column> cols(T);
+	double logProb = 0;
+
+	for (size_t t = 1; t < T; ++t)
+	{
+		double scale = (t == 1) ? initColumn(obs, true, cols[1], scratch)
+								: advance(cols[t-1], obs[t], true, cols[t], scratch);
+
+		/* Probability is zero; no such path can be built. */
+		if (scale <= 0)
+			return make_pair(-numeric_limits<double>::infinity(), vector<int>());
+
+		logProb += log(scale);
+	}
+
+	/* Start from the best final pair, then look up each pair's predecessor one column back. */
+	const Column& last = cols[T-1];
+	int p = last.pairs[max_element(last.values.begin(), last.values.end()) - last.values.begin()];
+
+	vector<int> path(T);
+	path[T-1] = p % N;
+	path[T-2] = p / N;
+
+	for (size_t t = T-1; t > 1; --t)
+	{
+		const Column& col = cols[t];
+		size_t n = lower_bound(col.pairs.begin(), col.pairs.end(), p) - col.pairs.begin();
+
+		path[t-2] = col.from[n];
+		p = path[t-2]*N + path[t-1];
+	}
+
+	return make_pair(logProb, path);
+}
+
+
+/* Scaled forward-backward over the pair trellis, as in DenseModel::accumulate(). The state
+ * marginals come from the pair posteriors gamma_t(j, k): s_t = k for t >= 1, and s_0 = j in the
+ * first column, which also yields the counts of pi and of the first-order transition. */
+double SecondOrderModel::accumulate(const vector<int>& obs, ExpectedCounts& counts,
+									vector<double>& transitions2) const
+{
+	if (obs.empty())
+		return 0;
+
+	size_t N = numStates(), M = numOutputs(), T = obs.size();
+
+	if (T == 1)
+	{
+		double sum = 0;
+		for (size_t j = 0; j < N; ++j)
+			sum += _initStates[j] * emission(j, obs[0]);
+		if (sum <= 0)
+			return -numeric_limits<double>::infinity();
+
+		for (size_t j = 0; j < N; ++j)
+		{
+			double g = _initStates[j] * emission(j, obs[0]) / sum;
+			counts.emissions[j*M + obs[0]] += g;
+			counts.initStates[j] += g;
+		}
+
+		++counts.sequences;
+		counts.logLikelihood += log(sum);
+		return log(sum);
+	}
+
+	Scratch scratch = {vector<double>(N*N), vector<int>(N*N)};
+	vector<Column> cols(T);
+	vector<double> scales(T);
+	double logProb = 0;
+
+	for (size_t t = 1; t < T; ++t)
+	{
+		scales[t] = (t == 1) ? initColumn(obs, false, cols[1], scratch)
+							 : advance(cols[t-1], obs[t], false, cols[t], scratch);
+		if (scales[t] <= 0)
+			return -numeric_limits<double>::infinity();
+
+		logProb += log(scales[t]);
+	}
+
+	/* Dense betas for the current and previous columns; zero off the live pairs. */
+	vector<double> beta(N*N), prevBeta(N*N);
+	for (auto p : cols[T-1].pairs)
+		beta[p] = 1;
+
+	for (size_t t = T-1; t >= 1; --t)
+	{
+		const Column& col = cols[t];
+
+		for (size_t n = 0; n < col.pairs.size(); ++n)
+		{
+			int p = col.pairs[n], j = p / N, k = p % N;
+			double g = col.values[n] * beta[p];
+
+			counts.emissions[k*M + obs[t]] += g;
+			if (t == 1)
+			{
+				counts.emissions[j*M + obs[0]] += g;
+				counts.initStates[j] += g;
+				counts.transitions[j*N + k] += g;
+			}
+		}
+
+		if (t == 1)
+			break;
+
+		/* beta_t-1(i, j) and xi_t-1(i, j, k) for the live pairs of the previous column. */
+		const Column& prev = cols[t-1];
+		for (size_t n = 0; n < prev.pairs.size(); ++n)
+		{
+			int p = prev.pairs[n], j = p % N;
+			double sum = 0;
+
+			for (size_t e = _rowStart[p]; e < _rowStart[p+1]; ++e)
+			{
+				int q = j*N + _next[e];
+				if (beta[q] == 0)
+					continue;
+
+				double w = _probs[e] * emission(_next[e], obs[t]) * beta[q] / scales[t];
+				sum += w;
+				transitions2[e] += prev.values[n] * w;
+			}
+			prevBeta[p] = sum;
+		}
+
+		for (auto p : col.pairs)
+			beta[p] = 0;
+		beta.swap(prevBeta);
+	}
+
+	++counts.sequences;
+	counts.logLikelihood += logProb;
+	return logProb;
+}
+
+
+void SecondOrderModel::reestimate(const ExpectedCounts& counts, const vector<double>& transitions2)
+{
+	size_t N = numStates(), M = numOutputs();
+	if (counts.numStates != N || counts.numOutputs != M || transitions2.size() != _probs.size())
+		throw runtime_error("expected counts do not match the model");
+
+	for (size_t p = 0; p < N*N; ++p)
+	{
+		double sum = 0;
+		for (size_t e = _rowStart[p]; e < _rowStart[p+1]; ++e)
+			sum += transitions2[e];
+		if (sum > 0)
+			for (size_t e = _rowStart[p]; e < _rowStart[p+1]; ++e)
+				_probs[e] = transitions2[e] / sum;
+	}
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		double sum = 0;
+		for (size_t j = 0; j < N; ++j)
+			sum += counts.transitions[i*N + j];
+		if (sum > 0)
+			for (size_t j = 0; j < N; ++j)
+				_transitions[i*N + j] = counts.transitions[i*N + j] / sum;
+
+		sum = 0;
+		for (size_t o = 0; o < M; ++o)
+			sum += counts.emissions[i*M + o];
+		if (sum > 0)
+			for (size_t o = 0; o < M; ++o)
+				_emissions[i*M + o] = counts.emissions[i*M + o] / sum;
+	}
+
+	if (counts.sequences > 0)
+		for (size_t i = 0; i < N; ++i)
+			_initStates[i] = counts.initStates[i] / counts.sequences;
+}
+
+
+void SecondOrderModel::save(const string& filename) const
+{
+	ofstream file(filename);
+	if (!file.is_open())
+		throw runtime_error("cannot create file: " + filename);
+
+	/* Enough digits for every parameter to read back as the same double. */
+	file.precision(numeric_limits<double>::max_digits10);
+
+	size_t N = numStates(), M = numOutputs();
+	file << N << " " << M << " " << _numOfTimeSteps << endl;
+
+	/* Write state names. */
+	for (auto stt : _stateNames)
+		file << stt << " ";
+	file << endl;
+
+	/* Write observation symbols. */
+	for (auto out : _outputNames)
+		file << out << " ";
+	file << endl;
+
+	/* Write transition matrix. */
+	file << "a:" << endl;
+	for (size_t i = 0; i < N; ++i)
+	{
+		for (size_t j = 0; j < N; ++j)
+			file << _transitions[i*N + j] << " ";
+		file << endl;
+	}
+
+	/* Write emission matrix. */
+	file << "b:" << endl;
+	for (size_t i = 0; i < N; ++i)
+	{
+		for (size_t o = 0; o < M; ++o)
+			file << emission(i, o) << " ";
+		file << endl;
+	}
+
+	/* Write initial state matrix. */
+	file << "pi:" << endl;
+	for (size_t i = 0; i < N; ++i)
+		file << _initStates[i] << " ";
+	file << endl;
+
+	/* Write second-order transition matrix, one row per pair of previous states. */
+	file << "a2:" << endl;
+	for (size_t p = 0; p < N*N; ++p)
+	{
+		vector<double> row(N);
+		for (size_t e = _rowStart[p]; e < _rowStart[p+1]; ++e)
+			row[_next[e]] = _probs[e];
+
+		for (auto prob : row)
+			file << prob << " ";
+		file << endl;
+	}
+}
+
+
+/* State j < N is "j at t = 0"; state N + i*N + j is the pair (i, j) of the two latest states,
+ * which emits as j. */
+DenseModel<double> SecondOrderModel::expanded() const
+{
+	size_t N = numStates(), M = numOutputs(), E = N + N*N;
+
+	vector<string> names;
+	for (size_t j = 0; j < N; ++j)
+		names.push_back(_stateNames[j]);
+	for (size_t i = 0; i < N; ++i)
+		for (size_t j = 0; j < N; ++j)
+			names.push_back(_stateNames[i] + ">" + _stateNames[j]);
+
+	vector<double> A(E*E), B(E*M), pi(E);
+
+	for (size_t j = 0; j < N; ++j)
+	{
+		pi[j] = _initStates[j];
+		for (size_t k = 0; k < N; ++k)
+			A[j*E + N + j*N + k] = _transitions[j*N + k];
+	}
+
+	for (size_t p = 0; p < N*N; ++p)
+		for (size_t e = _rowStart[p]; e < _rowStart[p+1]; ++e)
+			A[(N + p)*E + N + (p % N)*N + _next[e]] = _probs[e];
+
+	for (size_t s = 0; s < E; ++s)
+	{
+		size_t stt = (s < N) ? s : (s - N) % N;
+		for (size_t o = 0; o < M; ++o)
+			B[s*M + o] = emission(stt, o);
+	}
+
+	return DenseModel<double>(names, _outputNames, A, B, pi, _numOfTimeSteps);
+}
@@ -0,0 +1,125 @@
+#ifndef GUARD_SECOND_ORDER_MODEL_HPP
+#define GUARD_SECOND_ORDER_MODEL_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include "DenseModel.hpp"
+#include "ExpectedCounts.hpp"
+
+
+/**
+ * Second-order HMM, where the next state depends on the last two: P(s_t | s_t-2, s_t-1).
+ *
+ * The .hmm format is extended by an optional trailing block, so first-order readers still load
+ * such a file as its first-order part:
+ *
+ *     a2:
+ *     N*N lines of N probabilities; line i*N + j holds P(k | i, j) for every state k
+ *
+ * The first-order A of the file is used for the first transition only. Without an a2: block,
+ * P(k | i, j) defaults to a_jk.
+ *
+ * All passes run over the trellis of state pairs (s_t-1, s_t). The second-order transitions are
+ * stored as sparse rows and only pairs with non-zero mass are carried from step to step, so a
+ * step costs the number of transitions out of the live pairs rather than N^3. A beam can prune
+ * unlikely pairs further.
+ */
+class SecondOrderModel
+{
+public:
+	SecondOrderModel(const std::string& filename);
+
+	size_t numStates() const { return _stateNames.size(); }
+	size_t numOutputs() const { return _outputNames.size(); }
+	const std::vector<std::string>& states() const { return _stateNames; }
+	const std::vector<std::string>& outputs() const { return _outputNames; }
+	/** Returns the number of non-zero second-order transitions. */
+	size_t numTransitions() const { return _probs.size(); }
+
+	/**
+	 * Drop state pairs whose scaled forward (or Viterbi) value falls below beam times the largest
+	 * one in their column. 0, the default, keeps every pair and makes all passes exact.
+	 */
+	void setBeam(double beam) { _beam = beam; }
+
+	/**
+	 * Map an observation sequence to output symbol indices.
+	 */
+	std::vector<int> encode(const std::vector<std::string>& obs) const;
+
+	/**
+	 * Returns log P(obs | model), or -infinity if the sequence cannot be produced.
+	 */
+	double logLikelihood(const std::vector<int>& obs) const;
+	/**
+	 * Returns the log-probability of the most likely state path and the path itself. The path
+	 * is empty if no path can produce the sequence.
+	 */
+	std::pair<double, std::vector<int> > viterbi(const std::vector<int>& obs) const;
+
+	/**
+	 * Baum-Welch E-step: add the expected counts of a single sequence to counts, whose
+	 * transitions are those of the first step, and to transitions2, which parallels the sparse
+	 * second-order transitions. Returns the log-likelihood of the sequence.
+	 */
+	double accumulate(const std::vector<int>& obs, ExpectedCounts& counts,
+					  std::vector<double>& transitions2) const;
+	/**
+	 * Baum-Welch M-step: replace all probabilities by the normalized counts. Rows without any
+	 * counts keep their current probabilities.
+	 */
+	void reestimate(const ExpectedCounts& counts, const std::vector<double>& transitions2);
+
+	/**
+	 * Write this model as an .hmm file with an a2: block.
+	 */
+	void save(const std::string& filename) const;
+	/**
+	 * Returns the equivalent first-order model over N start states and N^2 state pairs, which
+	 * assigns every sequence the same probability.
+	 */
+	DenseModel<double> expanded() const;
+
+private:
+	/* One sparse trellis column: the live pairs i*N + j in increasing order, their values, and
+	 * for Viterbi the state i the best path came from. */
+	struct Column
+	{
+		std::vector<int> pairs, from;
+		std::vector<double> values;
+	};
+
+	/* Dense N x N accumulators for the column being built; all zero between steps. */
+	struct Scratch
+	{
+		std::vector<double> values;
+		std::vector<int> from;
+	};
+
+	double emission(size_t i, size_t o) const { return _emissions[i*numOutputs() + o]; }
+
+	double initColumn(const std::vector<int>&, bool, Column&, Scratch&) const;
+	double advance(const Column&, int, bool, Column&, Scratch&) const;
+	double finishColumn(bool, Column&, Scratch&) const;
+
+private:
+	size_t _numOfTimeSteps;
+	std::vector<std::string> _stateNames, _outputNames;
+	std::map<std::string, int> _outputIndex;
+
+	std::vector<double> _transitions;	// N x N, first transition only
+	std::vector<double> _emissions;		// N x M
+	std::vector<double> _initStates;	// N
+
+	/* Row i*N + j of the second-order transitions holds the states _next[e] with probabilities
+	 * _probs[e] for e in [_rowStart[i*N + j], _rowStart[i*N + j + 1]). */
+	std::vector<size_t> _rowStart;
+	std::vector<int> _next;
+	std::vector<double> _probs;
+
+	double _beam;
+};
+
+
+#endif
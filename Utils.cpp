@@ -1,3 +1,4 @@
+#include <cerrno>
 #include <fstream>
 #include <limits>
 #include <stdexcept>
@@ -25,6 +26,10 @@ vector<T> split(const string& line)
 	return ret;
 }
 
+/* Other translation units link against this one, which optimized builds would otherwise inline
+ * away. */
+template vector<string> split(const string& line);
+
 /* Template specializations must be defined before the first use of that specialization.
  * C++ templates. Gah. */
 template <>
@@ -97,3 +102,41 @@ vector<vector<string> > parseObsFile(const string& filename)
 	}
 	return observations;
 }
+
+
+/* Return the number of bytes in a size with an optional binary K, M or G suffix. */
+size_t parseSize(const string& size)
+{
+	/* strtoull() would accept a sign and wrap negative counts around. */
+	const char* begin = size.c_str();
+	while (isspace(*begin))
+		++begin;
+	if (!isdigit(*begin))
+		throw runtime_error("invalid size: " + size);
+
+	char* end;
+	errno = 0;
+	unsigned long long count = strtoull(begin, &end, 10);
+	if (errno == ERANGE || count > numeric_limits<size_t>::max())
+		throw runtime_error("size too large: " + size);
+
+	int shift = 0;
+	switch (toupper(*end))
+	{
+	case 'G':
+		shift += 10;
+		// fall through
+	case 'M':
+		shift += 10;
+		// fall through
+	case 'K':
+		shift += 10;
+		++end;
+	}
+
+	if (*end != '\0')
+		throw runtime_error("invalid size: " + size);
+	if (count > (numeric_limits<size_t>::max() >> shift))
+		throw runtime_error("size too large: " + size);
+	return size_t(count) << shift;
+}
@@ -8,6 +8,8 @@
 template <typename T> std::vector<T> split(const std::string& line);
 /** Return vector of observation sequences in an .obs file. */
 std::vector<std::vector<std::string> > parseObsFile(const std::string& filename);
+/** Return the number of bytes in a size such as "4096", "64K", "256M" or "2G". */
+size_t parseSize(const std::string& size);
 
 
 #endif
@@ -0,0 +1,130 @@
+#include <fstream>
+#include <iostream>
+#include "HiddenMarkovModel.hpp"
+#include "OnlineTrainer.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+
+void help(char*);
+
+
+int main(int argc, char** argv)
+{
+	if (argc <= 1)
+	{
+		help(argv[0]);
+		return 1;
+	}
+
+	/* Parse arguments. We accept one .hmm file to start from, one .hmm file to write, and any
+	 * number of .obs files. Without .obs files, sequences are read from standard input, one per
+	 * line, until it is closed. */
+	string hmmFilename, optHmmFilename, checkpointFilename;
+	vector<string> obsFilenames;
+	size_t batchSize = 16, checkpointEvery = 100, memoryBudget = 0;
+	double kappa = 0.7, offset = 4;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+
+		if (arg == "--batch" && i+1 < argc)
+			batchSize = strtol(argv[++i], NULL, 10);
+		else if (arg == "--kappa" && i+1 < argc)
+			kappa = strtod(argv[++i], NULL);
+		else if (arg == "--offset" && i+1 < argc)
+			offset = strtod(argv[++i], NULL);
+		else if (arg == "--checkpoint" && i+1 < argc)
+			checkpointFilename = argv[++i];
+		else if (arg == "--every" && i+1 < argc)
+			checkpointEvery = strtol(argv[++i], NULL, 10);
+		else if (arg == "--max-memory" && i+1 < argc)
+			memoryBudget = parseSize(argv[++i]);
+		else if (arg.find(".hmm") != string::npos)
+		{
+			if (hmmFilename.empty())
+				hmmFilename = arg;
+			else
+				optHmmFilename = arg;
+		}
+		else if (arg.find(".obs") != string::npos)
+			obsFilenames.push_back(arg);
+	}
+
+	if (hmmFilename.empty())
+	{
+		cerr << "no .hmm file found" << endl;
+		return 1;
+	}
+	if (optHmmFilename.empty())
+	{
+		cerr << "no output .hmm file found" << endl;
+		return 1;
+	}
+
+	HiddenMarkovModel hmm(hmmFilename);
+	DenseModel<double> model(hmm);
+	model.setMemoryBudget(memoryBudget);
+	OnlineTrainer trainer(model, batchSize, kappa, offset);
+
+	/* Pick up where an earlier run left off. */
+	if (!checkpointFilename.empty() && ifstream(checkpointFilename).good())
+		trainer.restore(checkpointFilename);
+
+	/* Print the average log-likelihood of every mini-batch, and checkpoint periodically. */
+	size_t reported = trainer.updates();
+	auto consume = [&](const vector<string>& obs)
+	{
+		trainer.add(obs);
+
+		if (trainer.updates() != reported)
+		{
+			reported = trainer.updates();
+			cout << reported << " " << trainer.lastLogLikelihood() << endl;
+
+			if (!checkpointFilename.empty() && checkpointEvery > 0 &&
+				reported % checkpointEvery == 0)
+				trainer.checkpoint(checkpointFilename);
+		}
+	};
+
+	if (obsFilenames.empty())
+	{
+		string line;
+		while (getline(cin, line))
+		{
+			vector<string> obs = split<string>(line);
+			if (!obs.empty())
+				consume(obs);
+		}
+	}
+	else
+	{
+		for (auto filename : obsFilenames)
+			for (auto obs : parseObsFile(filename))
+				consume(obs);
+	}
+
+	trainer.flush();
+	if (trainer.updates() != reported)
+		cout << trainer.updates() << " " << trainer.lastLogLikelihood() << endl;
+
+	if (trainer.skipped() > 0)
+		cerr << "skipped " << trainer.skipped() << " sequence(s) the model cannot produce "
+			 << "or with unknown outputs" << endl;
+
+	if (!checkpointFilename.empty())
+		trainer.checkpoint(checkpointFilename);
+
+	model.save(optHmmFilename);
+	return 0;
+}
+
+
+void help(char* program)
+{
+	cout << program << ": [--batch B] [--kappa k] [--offset t0] [--checkpoint file] [--every n] "
+		 << "[--max-memory bytes] [model.hmm] [observation.obs ...] [adapted_model.hmm]" << endl;
+}
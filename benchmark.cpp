@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include "DenseModel.hpp"
+#include "HiddenMarkovModel.hpp"
+#include "SecondOrderModel.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+
+void help(char*);
+
+
+/* Return the average wall clock time of one call of f over repeat calls, in milliseconds. */
+template <typename F>
+double timeIt(int repeat, F f)
+{
+	auto start = chrono::steady_clock::now();
+	for (int r = 0; r < repeat; ++r)
+		f();
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count() / repeat;
+}
+
+
+/* Cost of list Viterbi as K grows, against plain Viterbi. */
+void benchNbest(DenseModel<double>& model, const vector<vector<int> >& sequences, int repeat)
+{
+	double base = timeIt(repeat, [&]() {
+		for (auto obs : sequences)
+			model.viterbi(obs);
+	});
+
+	cout << "K\tms\tx viterbi" << endl;
+	cout << "viterbi\t" << base << "\t1" << endl;
+
+	for (size_t K = 1; K <= 64; K *= 2)
+	{
+		double ms = timeIt(repeat, [&]() {
+			for (auto obs : sequences)
+				model.nbest(obs, K);
+		});
+		cout << K << "\t" << ms << "\t" << ms / base << endl;
+	}
+}
+
+
+/* Attainable peaks of this machine for this build, measured with the given number of threads:
+ * STREAM triad bandwidth in GB/s, and multiply-add throughput in GFLOP/s. */
+pair<double, double> measurePeaks(unsigned threads)
+{
+	const size_t n = 1 << 22;
+	vector<double> a(n), b(n, 1.0), c(n, 2.0);
+	double bandwidth = 0, flops = 0;
+
+	auto parallel = [&](function<void(unsigned)> f) {
+		vector<thread> workers;
+		for (unsigned w = 0; w < threads; ++w)
+			workers.push_back(thread(f, w));
+		for (auto& w : workers)
+			w.join();
+	};
+
+	for (int r = 0; r < 3; ++r)
+	{
+		double ms = timeIt(1, [&]() {
+			parallel([&](unsigned w) {
+				for (size_t i = n*w/threads; i < n*(w+1)/threads; ++i)
+					a[i] = b[i] + 3.0*c[i];
+			});
+		});
+		bandwidth = max(bandwidth, 3*n*sizeof(double) / ms / 1e6);
+	}
+
+	/* Eight independent chains per thread, so the loop is bound by throughput, not latency. */
+	const size_t iterations = 1 << 24;
+	vector<double> sinks(threads);
+
+	double ms = timeIt(1, [&]() {
+		parallel([&](unsigned w) {
+			double acc[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+			for (size_t i = 0; i < iterations; ++i)
+				for (int k = 0; k < 8; ++k)
+					acc[k] = acc[k]*0.999999 + 1e-7;
+			for (int k = 0; k < 8; ++k)
+				sinks[w] += acc[k];
+		});
+	});
+	flops = 2.0*8*iterations*threads / ms / 1e6;
+
+	/* Keep the chains from being optimized away. */
+	volatile double sink = accumulate(sinks.begin(), sinks.end(), 0.0);
+	(void)sink;
+
+	return make_pair(bandwidth, flops);
+}
+
+
+/* Forward pass throughput, one sequence at a time against the tiled lock step, and the tiled
+ * lock step against a single tile. A step costs about 2 N^2 flops; memory traffic assumes A is
+ * streamed from memory once per pass over it, i.e. once per sequence and step when sequences
+ * run one at a time, and once per thread and step in lock step. */
+void benchTrellis(DenseModel<double>& model, const vector<vector<int> >& sequences, int repeat,
+				  const BatchOptions& options)
+{
+	pair<double, double> peaks = measurePeaks(options.threads);
+	double N = model.numStates();
+
+	vector<size_t> lengths;
+	for (auto obs : sequences)
+		lengths.push_back(obs.size());
+	sort(lengths.rbegin(), lengths.rend());
+
+	double steps = 0, lockSteps = 0;
+	for (size_t k = 0; k < lengths.size(); ++k)
+	{
+		steps += max<size_t>(lengths[k], 1) - 1;
+		if (k < options.threads)
+			lockSteps += max<size_t>(lengths[k], 1) - 1;
+	}
+
+	double flops = 2*N*N*steps, bytes = N*N*sizeof(double);
+
+	BatchOptions untiled = options;
+	untiled.tile = model.numStates();
+
+	double sequential = timeIt(repeat, [&]() {
+		for (auto obs : sequences)
+			model.logLikelihood(obs);
+	});
+	double single = timeIt(repeat, [&]() { model.batchLogLikelihood(sequences, untiled); });
+	double tiled = timeIt(repeat, [&]() { model.batchLogLikelihood(sequences, options); });
+
+	cout << "peak: " << peaks.first << " GB/s triad, " << peaks.second << " GFLOP/s" << endl;
+	cout << "pass	ms	GFLOP/s	%peak	GB/s	%peak" << endl;
+
+	const char* names[] = {"sequential", "lockstep", "tiled"};
+	double times[] = {sequential, single, tiled};
+	double traffic[] = {bytes*steps, bytes*lockSteps, bytes*lockSteps};
+
+	for (int k = 0; k < 3; ++k)
+	{
+		double gflops = flops / times[k] / 1e6, gbps = traffic[k] / times[k] / 1e6;
+		cout << names[k] << "\t" << times[k] << "\t" << gflops << "\t"
+			 << 100*gflops/peaks.second << "\t" << gbps << "\t" << 100*gbps/peaks.first << endl;
+	}
+}
+
+
+/* Sequential forward, Viterbi and E-step passes with plain A, then with A fused with the
+ * emissions of the outputs most frequent in the timed sequences, within maxBytes. */
+void benchFusion(DenseModel<double>& model, const vector<vector<int> >& sequences, int repeat,
+				 size_t maxBytes)
+{
+	auto passes = [&](double* times) {
+		times[0] = timeIt(repeat, [&]() {
+			for (auto& obs : sequences)
+				model.logLikelihood(obs);
+		});
+		times[1] = timeIt(repeat, [&]() {
+			for (auto& obs : sequences)
+				model.viterbi(obs);
+		});
+		times[2] = timeIt(repeat, [&]() {
+			ExpectedCounts counts(model.numStates(), model.numOutputs());
+			for (auto& obs : sequences)
+				model.accumulate(obs, counts);
+		});
+	};
+
+	double plain[3], fused[3];
+	passes(plain);
+	size_t fusedOutputs = model.fuseHotOutputs(sequences, maxBytes);
+	passes(fused);
+
+	/* Steps after the first on a fused output are the ones that use its matrix. */
+	vector<char> isFused(model.numOutputs());
+	for (auto o : model.fusedOutputs())
+		isFused[o] = 1;
+
+	double steps = 0, fusedSteps = 0;
+	for (auto& obs : sequences)
+		for (size_t t = 1; t < obs.size(); ++t)
+		{
+			++steps;
+			fusedSteps += isFused[obs[t]];
+		}
+
+	model.fuseHotOutputs(sequences, 0);
+
+	cout << "fused outputs: " << fusedOutputs << " of " << model.numOutputs() << ", covering "
+		 << (steps > 0 ? 100*fusedSteps/steps : 0) << "% of steps" << endl;
+	cout << "pass\tplain ms\tfused ms\tspeedup" << endl;
+
+	const char* names[] = {"forward", "viterbi", "e-step"};
+	for (int k = 0; k < 3; ++k)
+		cout << names[k] << "\t" << plain[k] << "\t" << fused[k] << "\t" << plain[k] / fused[k]
+			 << endl;
+}
+
+
+/* Sparse second-order passes against the equivalent dense first-order model over N + N^2 states,
+ * and against the first-order part alone, an N-state model that ignores s_t-2. */
+void benchOrder2(const SecondOrderModel& second, DenseModel<double>& first,
+				 const vector<vector<int> >& sequences, int repeat)
+{
+	DenseModel<double> expanded = second.expanded();
+	double N = second.numStates();
+
+	double deviation = 0;
+	for (auto obs : sequences)
+		deviation = max(deviation, fabs(second.logLikelihood(obs) - expanded.logLikelihood(obs)));
+
+	cout << "transitions: " << second.numTransitions() << " of " << N*N*N << " ("
+		 << 100*second.numTransitions() / (N*N*N) << "%)" << endl;
+	cout << "max log-likelihood deviation from expanded: " << deviation << endl;
+	cout << "model	states	forward ms	viterbi ms" << endl;
+
+	auto row = [&](const string& name, size_t states, function<void(const vector<int>&)> forward,
+				   function<void(const vector<int>&)> viterbi) {
+		double fw = timeIt(repeat, [&]() {
+			for (auto obs : sequences)
+				forward(obs);
+		});
+		double vt = timeIt(repeat, [&]() {
+			for (auto obs : sequences)
+				viterbi(obs);
+		});
+		cout << name << "\t" << states << "\t" << fw << "\t" << vt << endl;
+	};
+
+	row("first", first.numStates(), [&](const vector<int>& obs) { first.logLikelihood(obs); },
+		[&](const vector<int>& obs) { first.viterbi(obs); });
+	row("second", second.numStates(), [&](const vector<int>& obs) { second.logLikelihood(obs); },
+		[&](const vector<int>& obs) { second.viterbi(obs); });
+	row("expanded", expanded.numStates(),
+		[&](const vector<int>& obs) { expanded.logLikelihood(obs); },
+		[&](const vector<int>& obs) { expanded.viterbi(obs); });
+}
+
+
+int main(int argc, char** argv)
+{
+	if (argc <= 2)
+	{
+		help(argv[0]);
+		return 1;
+	}
+
+	/* Parse arguments. The first names the benchmark; then one .hmm file and any number of .obs
+	 * files, whose sequences are all timed together. */
+	string benchmark(argv[1]), hmmFilename;
+	vector<string> obsFilenames;
+	int repeat = 3;
+	double beam = 0;
+	size_t fuseBytes = size_t(64) << 20;
+	BatchOptions options;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		string arg(argv[i]);
+
+		if (arg == "--repeat" && i+1 < argc)
+			repeat = max(1, int(strtol(argv[++i], NULL, 10)));
+		else if (arg == "--threads" && i+1 < argc)
+			options.threads = max(1, int(strtol(argv[++i], NULL, 10)));
+		else if (arg == "--tile" && i+1 < argc)
+			options.tile = strtol(argv[++i], NULL, 10);
+		else if (arg == "--numa")
+			options.replicate = true;
+		else if (arg == "--beam" && i+1 < argc)
+			beam = strtod(argv[++i], NULL);
+		else if (arg == "--fuse" && i+1 < argc)
+			fuseBytes = parseSize(argv[++i]);
+		else if (arg.find(".hmm") != string::npos)
+			hmmFilename = arg;
+		else if (arg.find(".obs") != string::npos)
+			obsFilenames.push_back(arg);
+	}
+
+	if (hmmFilename.empty())
+	{
+		cerr << "no .hmm file found" << endl;
+		return 1;
+	}
+
+	HiddenMarkovModel hmm(hmmFilename);
+	DenseModel<double> model(hmm);
+
+	vector<vector<int> > sequences;
+	for (auto filename : obsFilenames)
+		for (auto obs : parseObsFile(filename))
+			sequences.push_back(model.encode(obs));
+
+	if (benchmark == "nbest")
+		benchNbest(model, sequences, repeat);
+	else if (benchmark == "trellis")
+		benchTrellis(model, sequences, repeat, options);
+	else if (benchmark == "fusion")
+		benchFusion(model, sequences, repeat, fuseBytes);
+	else if (benchmark == "order2")
+	{
+		SecondOrderModel second(hmmFilename);
+		second.setBeam(beam);
+		benchOrder2(second, model, sequences, repeat);
+	}
+	else
+	{
+		cerr << "unknown benchmark: " << benchmark << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+void help(char* program)
+{
+	cout << program << ": nbest [--repeat R] [model.hmm] [observation.obs ...]" << endl;
+	cout << program << ": trellis [--repeat R] [--threads P] [--tile side] [--numa] [model.hmm] "
+		 << "[observation.obs ...]" << endl;
+	cout << program << ": fusion [--repeat R] [--fuse bytes] [model.hmm] [observation.obs ...]"
+		 << endl;
+	cout << program << ": order2 [--repeat R] [--beam b] [model.hmm] [observation.obs ...]" << endl;
+	cout << "Build with \"make benchmark-opt\" for timings of optimized code." << endl;
+}
@@ -0,0 +1,102 @@
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include "EmissionModel.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+
+void help(char*);
+vector<FeatureSequence> parseFeatureText(const string&);
+
+
+int main(int argc, char** argv)
+{
+	if (argc <= 1)
+	{
+		help(argv[0]);
+		return 1;
+	}
+
+	/* Parse arguments. We accept any number of text files to convert and one .feat file to
+	 * write. */
+	string featFilename;
+	vector<string> textFilenames;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+
+		if (arg.find(".feat") != string::npos)
+			featFilename = arg;
+		else
+			textFilenames.push_back(arg);
+	}
+
+	if (featFilename.empty())
+	{
+		cerr << "no output .feat file found" << endl;
+		return 1;
+	}
+	if (textFilenames.empty())
+	{
+		cerr << "no input feature file found" << endl;
+		return 1;
+	}
+
+	vector<FeatureSequence> sequences;
+	for (auto filename : textFilenames)
+		for (auto& seq : parseFeatureText(filename))
+			sequences.push_back(seq);
+
+	writeFeatureFile(featFilename, sequences);
+	cout << sequences.size() << " sequence(s) written to " << featFilename << endl;
+	return 0;
+}
+
+
+/* The text layout follows .obs files: the number of sequences, then for every sequence its
+ * number of frames T on a line of its own and T lines of D values each. */
+vector<FeatureSequence> parseFeatureText(const string& filename)
+{
+	ifstream file(filename);
+	if (!file.is_open())
+		throw runtime_error("file not found: " + filename);
+
+	int count = 0;
+	file >> count;
+	file.ignore(numeric_limits<streamsize>::max(), '\n');
+
+	vector<FeatureSequence> ret(count);
+
+	for (auto& seq : ret)
+	{
+		size_t T = 0;
+		file >> T;
+		file.ignore(numeric_limits<streamsize>::max(), '\n');
+
+		for (size_t t = 0; t < T; ++t)
+		{
+			string line;
+			if (!getline(file, line))
+				throw runtime_error("truncated feature file: " + filename);
+
+			vector<double> frame = split<double>(line);
+			if (seq.dimension == 0)
+				seq.dimension = frame.size();
+			if (frame.empty() || frame.size() != seq.dimension)
+				throw runtime_error("frames differ in dimension in " + filename);
+
+			seq.frames.insert(seq.frames.end(), frame.begin(), frame.end());
+		}
+	}
+	return ret;
+}
+
+
+void help(char* program)
+{
+	cout << program << ": [features.txt ...] [features.feat]" << endl;
+}
@@ -1,7 +1,11 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include "ContinuousModel.hpp"
+#include "Distributed.hpp"
 #include "HiddenMarkovModel.hpp"
+#include "SecondOrderModel.hpp"
+#include "Utils.hpp"
 
 using namespace std;
 
@@ -17,14 +21,29 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	/* Parse arguments. We accept only one .hmm file and one .obs file. */
-	string hmmFilename, obsFilename, optHmmFilename;
+	/* Parse arguments. We accept one .hmm file to start from, one .hmm file to write, and either
+	 * one .obs file or, when training with worker processes, one .obs file per shard. */
+	string hmmFilename, optHmmFilename;
+	vector<string> obsFilenames, featFilenames;
+	int workers = 0, iterations = 1, order = 1;
+	size_t memoryBudget = 0;
+	double beam = 0;
 
 	for (int i = 1; i < argc; ++i)
 	{
 		string arg(argv[i]);
 
-		if (arg.find(".hmm") != string::npos)
+		if (arg == "--workers" && i+1 < argc)
+			workers = strtol(argv[++i], NULL, 10);
+		else if (arg == "--iterations" && i+1 < argc)
+			iterations = strtol(argv[++i], NULL, 10);
+		else if (arg == "--max-memory" && i+1 < argc)
+			memoryBudget = parseSize(argv[++i]);
+		else if (arg == "--order" && i+1 < argc)
+			order = strtol(argv[++i], NULL, 10);
+		else if (arg == "--beam" && i+1 < argc)
+			beam = strtod(argv[++i], NULL);
+		else if (arg.find(".hmm") != string::npos)
 		{
 			if (hmmFilename.empty())
 				hmmFilename = arg;
@@ -32,7 +51,9 @@ int main(int argc, char** argv)
 				optHmmFilename = arg;
 		}
 		else if (arg.find(".obs") != string::npos)
-			obsFilename = arg;
+			obsFilenames.push_back(arg);
+		else if (arg.find(".feat") != string::npos)
+			featFilenames.push_back(arg);
 	}
 
 	if (hmmFilename.empty())
@@ -40,7 +61,7 @@ int main(int argc, char** argv)
 		cerr << "no .hmm file found" << endl;
 		return 1;
 	}
-	if (obsFilename.empty())
+	if (obsFilenames.empty() && featFilenames.empty())
 	{
 		cerr << "no input .obs file found" << endl;
 		return 1;
@@ -50,7 +71,129 @@ int main(int argc, char** argv)
 		cerr << "no output .obs file found" << endl;
 		return 1;
 	}
+	if (order != 1 && order != 2)
+	{
+		cerr << "unsupported model order: " << order << endl;
+		return 1;
+	}
+	if (order == 2 && (workers > 0 || memoryBudget > 0 || !featFilenames.empty()))
+	{
+		cerr << "--order 2 takes neither --workers, --max-memory nor .feat files" << endl;
+		return 1;
+	}
+
+	/* Baum-Welch for a continuous model over the sequences of all feature files. */
+	if (!featFilenames.empty())
+	{
+		ContinuousModel model(hmmFilename);
+
+		vector<FeatureSequence> sequences;
+		for (auto filename : featFilenames)
+			for (auto obs : readFeatureFile(filename))
+				sequences.push_back(obs);
+
+		/* Print the log-likelihood the model had at the start of each iteration. */
+		for (int k = 0; k < iterations; ++k)
+		{
+			ExpectedCounts counts(model.numStates(), 0);
+
+			for (auto& obs : sequences)
+				model.accumulate(obs, counts);
+
+			cout << counts.logLikelihood << endl;
+			model.reestimate(counts);
+		}
+
+		model.save(optHmmFilename);
+		return 0;
+	}
+
+	/* Second-order Baum-Welch over the sequences of all .obs files, in this process. */
+	if (order == 2)
+	{
+		SecondOrderModel model(hmmFilename);
+		model.setBeam(beam);
+
+		vector<vector<int> > sequences;
+		for (auto filename : obsFilenames)
+			for (auto obs : parseObsFile(filename))
+				sequences.push_back(model.encode(obs));
+
+		/* Print the log-likelihood the model had at the start of each iteration. */
+		for (int k = 0; k < iterations; ++k)
+		{
+			ExpectedCounts counts(model.numStates(), model.numOutputs());
+			vector<double> transitions2(model.numTransitions());
+
+			for (auto obs : sequences)
+				model.accumulate(obs, counts, transitions2);
+
+			cout << counts.logLikelihood << endl;
+			model.reestimate(counts, transitions2);
+		}
+
+		model.save(optHmmFilename);
+		return 0;
+	}
+
+	/* Several shards or an explicit worker count select data-parallel training over all
+	 * sequences. Without --workers, every .obs file is its own shard; with it, the sequences of
+	 * all files are dealt round-robin to the workers. */
+	if (workers > 0 || obsFilenames.size() > 1)
+	{
+		HiddenMarkovModel hmm(hmmFilename);
+		DenseModel<double> model(hmm);
+		model.setMemoryBudget(memoryBudget);
+
+		vector<Shard> shards;
+		if (workers > 0)
+		{
+			for (int w = 0; w < workers; ++w)
+				shards.push_back(Shard{obsFilenames, size_t(w), size_t(workers)});
+		}
+		else
+		{
+			for (auto filename : obsFilenames)
+				shards.push_back(Shard{vector<string>(1, filename), 0, 1});
+		}
+
+		/* Print the log-likelihood the model had at the start of each iteration. */
+		for (auto logProb : trainDistributed(model, shards, iterations))
+			cout << logProb << endl;
+
+		model.save(optHmmFilename);
+		return 0;
+	}
+
+	/* A memory budget alone selects the dense model, which can bound its trellis, in this
+	 * process. */
+	if (memoryBudget > 0)
+	{
+		HiddenMarkovModel hmm(hmmFilename);
+		DenseModel<double> model(hmm);
+		model.setMemoryBudget(memoryBudget);
+
+		vector<vector<int> > sequences;
+		for (auto obs : parseObsFile(obsFilenames[0]))
+			sequences.push_back(model.encode(obs));
+
+		/* Print the log-likelihood the model had at the start of each iteration. */
+		for (int k = 0; k < iterations; ++k)
+		{
+			ExpectedCounts counts(model.numStates(), model.numOutputs());
+
+			for (auto& obs : sequences)
+				model.accumulate(obs, counts);
+
+			cout << counts.logLikelihood << endl;
+			model.reestimate(counts);
+		}
+
+		model.save(optHmmFilename);
+		return 0;
+	}
 
+	string obsFilename = obsFilenames[0];
 
 	HiddenMarkovModel hmm(hmmFilename);
 	cout << hmm.forward(obsFilename)[0];
@@ -67,4 +210,10 @@ int main(int argc, char** argv)
 void help(char* program)
 {
 	cout << program << ": [model.hmm] [observation.obs] [optimized_model.hmm]" << endl;
+	cout << program << ": [--workers N] [--iterations K] [--max-memory bytes] [model.hmm] "
+		 << "[shard.obs ...] [optimized_model.hmm]" << endl;
+	cout << program << ": --order 2 [--beam b] [--iterations K] [model.hmm] [observation.obs ...] "
+		 << "[optimized_model.hmm]" << endl;
+	cout << program << ": [--iterations K] [continuous_model.hmm] [features.feat ...] "
+		 << "[optimized_model.hmm]" << endl;
 }
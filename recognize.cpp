@@ -1,7 +1,12 @@
 #include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include "ContinuousModel.hpp"
+#include "DenseModel.hpp"
 #include "HiddenMarkovModel.hpp"
+#include "SecondOrderModel.hpp"
+#include "Utils.hpp"
 
 using namespace std;
 
@@ -18,17 +23,27 @@ int main(int argc, char** argv)
 	}
 
 	/* Parse arguments. We accept only one .hmm file but allow multiple .obs files. */
-	string hmmFilename;
-	vector<string> obsFilenames;
+	string hmmFilename, precision;
+	vector<string> obsFilenames, featFilenames;
+	int order = 1;
+	double beam = 0;
 
 	for (int i = 1; i < argc; ++i)
 	{
 		string arg(argv[i]);
 
-		if (arg.find(".hmm") != string::npos)
+		if (arg == "--precision" && i+1 < argc)
+			precision = argv[++i];
+		else if (arg == "--order" && i+1 < argc)
+			order = strtol(argv[++i], NULL, 10);
+		else if (arg == "--beam" && i+1 < argc)
+			beam = strtod(argv[++i], NULL);
+		else if (arg.find(".hmm") != string::npos)
 			hmmFilename = arg;
 		else if (arg.find(".obs") != string::npos)
 			obsFilenames.push_back(arg);
+		else if (arg.find(".feat") != string::npos)
+			featFilenames.push_back(arg);
 	}
 
 	if (hmmFilename.empty())
@@ -36,6 +51,66 @@ int main(int argc, char** argv)
 		cerr << "no .hmm file found" << endl;
 		return 1;
 	}
+	if (order != 1 && order != 2)
+	{
+		cerr << "unsupported model order: " << order << endl;
+		return 1;
+	}
+	if (order == 2 && (!precision.empty() || !featFilenames.empty()))
+	{
+		cerr << "--order 2 takes neither --precision nor .feat files" << endl;
+		return 1;
+	}
+
+	/* Feature files are scored by a continuous model; densities are printed as logs, since they
+	 * need not stay below one. */
+	if (!featFilenames.empty())
+	{
+		ContinuousModel model(hmmFilename);
+
+		for (auto i = featFilenames.begin(); i != featFilenames.end(); ++i)
+		{
+			cout << *i << ":" << endl;
+
+			for (auto obs : readFeatureFile(*i))
+				cout << model.logLikelihood(obs) << endl;
+		}
+
+		return 0;
+	}
+
+	/* A second-order model reads the a2: block of the file, if any. */
+	if (order == 2)
+	{
+		SecondOrderModel model(hmmFilename);
+		model.setBeam(beam);
+
+		for (auto i = obsFilenames.begin(); i != obsFilenames.end(); ++i)
+		{
+			cout << *i << ":" << endl;
+
+			for (auto obs : parseObsFile(*i))
+				cout << exp(model.logLikelihood(model.encode(obs))) << endl;
+		}
+
+		return 0;
+	}
+
+	/* A requested precision selects the scaled dense model instead of the reference one. */
+	if (!precision.empty())
+	{
+		unique_ptr<Scorer> scorer = loadScorer(hmmFilename, parsePrecision(precision));
+
+		for (auto i = obsFilenames.begin(); i != obsFilenames.end(); ++i)
+		{
+			cout << *i << ":" << endl;
+
+			for (auto result : scorer->logLikelihoods(parseObsFile(*i)))
+				cout << exp(result) << endl;
+		}
+
+		return 0;
+	}
 
 	HiddenMarkovModel hmm(hmmFilename);
 
@@ -55,5 +130,8 @@ int main(int argc, char** argv)
 
 void help(char* program)
 {
-	cout << program << ": [model.hmm] [observation.obs ...]" << endl;
+	cout << program << ": [--precision double|float|mixed] [model.hmm] [observation.obs ...]"
+		 << endl;
+	cout << program << ": --order 2 [--beam b] [model.hmm] [observation.obs ...]" << endl;
+	cout << program << ": [continuous_model.hmm] [features.feat ...]" << endl;
 }
@@ -1,6 +1,11 @@
 #include <algorithm>
+#include <cmath>
 #include <iostream>
+#include "ContinuousModel.hpp"
+#include "DenseModel.hpp"
 #include "HiddenMarkovModel.hpp"
+#include "SecondOrderModel.hpp"
+#include "Utils.hpp"
 
 using namespace std;
 
@@ -17,17 +22,30 @@ int main(int argc, char** argv)
 	}
 
 	/* Parse arguments. We accept only one .hmm file but allow multiple .obs files. */
-	string hmmFilename;
-	vector<string> obsFilenames;
+	string hmmFilename, precision;
+	vector<string> obsFilenames, featFilenames;
+	size_t K = 0;
+	int order = 1;
+	double beam = 0;
 
 	for (int i = 1; i < argc; ++i)
 	{
 		string arg(argv[i]);
 
-		if (arg.find(".hmm") != string::npos)
+		if (arg == "--precision" && i+1 < argc)
+			precision = argv[++i];
+		else if (arg == "--nbest" && i+1 < argc)
+			K = strtol(argv[++i], NULL, 10);
+		else if (arg == "--order" && i+1 < argc)
+			order = strtol(argv[++i], NULL, 10);
+		else if (arg == "--beam" && i+1 < argc)
+			beam = strtod(argv[++i], NULL);
+		else if (arg.find(".hmm") != string::npos)
 			hmmFilename = arg;
 		else if (arg.find(".obs") != string::npos)
 			obsFilenames.push_back(arg);
+		else if (arg.find(".feat") != string::npos)
+			featFilenames.push_back(arg);
 	}
 
 	if (hmmFilename.empty())
@@ -35,6 +53,70 @@ int main(int argc, char** argv)
 		cerr << "no .hmm file found" << endl;
 		return 1;
 	}
+	if (order != 1 && order != 2)
+	{
+		cerr << "unsupported model order: " << order << endl;
+		return 1;
+	}
+	if (order == 2 && (!precision.empty() || K > 0 || !featFilenames.empty()))
+	{
+		cerr << "--order 2 takes neither --precision, --nbest nor .feat files" << endl;
+		return 1;
+	}
+
+	/* Feature files are decoded by a continuous model, printing log-densities. */
+	if (!featFilenames.empty())
+	{
+		ContinuousModel model(hmmFilename);
+
+		for (auto i = featFilenames.begin(); i != featFilenames.end(); ++i)
+		{
+			cout << *i << ":" << endl;
+
+			for (auto obs : readFeatureFile(*i))
+			{
+				pair<double, vector<int> > best = model.viterbi(obs);
+				cout << best.first;
+
+				for_each(best.second.begin(), best.second.end(),
+						 [&](int s) { cout << " " << model.states()[s]; });
+
+				cout << endl;
+			}
+		}
+
+		return 0;
+	}
+
+	/* A second-order model reads the a2: block of the file, if any. */
+	if (order == 2)
+	{
+		SecondOrderModel model(hmmFilename);
+		model.setBeam(beam);
+
+		for (auto i = obsFilenames.begin(); i != obsFilenames.end(); ++i)
+		{
+			cout << *i << ":" << endl;
+
+			for (auto obs : parseObsFile(*i))
+			{
+				pair<double, vector<int> > best = model.viterbi(model.encode(obs));
+				cout << exp(best.first);
+
+				for_each(best.second.begin(), best.second.end(),
+						 [&](int s) { cout << " " << model.states()[s]; });
+
+				cout << endl;
+			}
+		}
+
+		return 0;
+	}
+
+	/* A requested precision selects the scaled dense model instead of the reference one. */
+	unique_ptr<Scorer> scorer;
+	if (!precision.empty())
+		scorer = loadScorer(hmmFilename, parsePrecision(precision));
 
 	HiddenMarkovModel hmm(hmmFilename);
 
@@ -43,8 +125,49 @@ int main(int argc, char** argv)
 	{
 		cout << *i << ":" << endl;
 
+		/* With --nbest, print the K best paths of each sequence with their probabilities, on the
+		 * same scale as plain decoding, followed by a blank line. */
+		if (K > 0)
+		{
+			vector<vector<pair<double, vector<string> > > > lists;
+			if (scorer)
+			{
+				for (auto obs : parseObsFile(*i))
+					lists.push_back(scorer->nbest(obs, K));
+			}
+			else
+				lists = hmm.nbest(*i, K);
+
+			for (auto list : lists)
+			{
+				for (auto result : list)
+				{
+					cout << exp(result.first);
+
+					const vector<string>& path = result.second;
+					for_each(path.begin(), path.end(), [](const string& s) { cout << " " << s; });
+
+					cout << endl;
+				}
+				cout << endl;
+			}
+			continue;
+		}
+
+		vector<pair<double, vector<string> > > results;
+		if (scorer)
+		{
+			for (auto obs : parseObsFile(*i))
+			{
+				pair<double, vector<string> > best = scorer->viterbi(obs);
+				results.push_back(make_pair(exp(best.first), best.second));
+			}
+		}
+		else
+			results = hmm.viterbi(*i);
+
 		/* Print the statepath results for each observation in this file. */
-		for (auto result : hmm.viterbi(*i))
+		for (auto result : results)
 		{
 			cout << result.first;
 
@@ -61,5 +184,8 @@ int main(int argc, char** argv)
 
 void help(char* program)
 {
-	cout << program << ": [model.hmm] [observation.obs ...]" << endl;
+	cout << program << ": [--precision double|float|mixed] [--nbest K] [model.hmm] "
+		 << "[observation.obs ...]" << endl;
+	cout << program << ": --order 2 [--beam b] [model.hmm] [observation.obs ...]" << endl;
+	cout << program << ": [continuous_model.hmm] [features.feat ...]" << endl;
 }
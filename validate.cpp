@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "ContinuousModel.hpp"
+#include "DenseModel.hpp"
+#include "HiddenMarkovModel.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+
+void help(char*);
+
+
+int main(int argc, char** argv)
+{
+	if (argc <= 1)
+	{
+		help(argv[0]);
+		return 1;
+	}
+
+	/* Parse arguments. We accept only one .hmm file but allow multiple .obs or .feat files. */
+	string hmmFilename;
+	vector<string> obsFilenames, featFilenames;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+
+		if (arg.find(".hmm") != string::npos)
+			hmmFilename = arg;
+		else if (arg.find(".obs") != string::npos)
+			obsFilenames.push_back(arg);
+		else if (arg.find(".feat") != string::npos)
+			featFilenames.push_back(arg);
+	}
+
+	if (hmmFilename.empty())
+	{
+		cerr << "no .hmm file found" << endl;
+		return 1;
+	}
+
+	/* A continuous model is checked by scoring every frame for every state once more, directly. */
+	if (!featFilenames.empty())
+	{
+		ContinuousModel model(hmmFilename);
+		const EmissionModel& emissions = model.emissions();
+		size_t N = model.numStates(), frames = 0, zeroMismatches = 0;
+		double maxDeviation = 0;
+
+		for (auto filename : featFilenames)
+		{
+			for (auto& obs : readFeatureFile(filename))
+			{
+				vector<double> logb;
+				emissions.logDensities(obs, logb);
+
+				for (size_t t = 0; t < obs.length(); ++t, ++frames)
+				{
+					for (size_t i = 0; i < N; ++i)
+					{
+						double expected = emissions.logDensity(i, obs.frame(t));
+						double actual = logb[t*N + i];
+
+						if (isinf(expected) || isinf(actual))
+						{
+							if (isinf(expected) != isinf(actual))
+								++zeroMismatches;
+						}
+						else
+							maxDeviation = max(maxDeviation, fabs(actual - expected));
+					}
+				}
+			}
+		}
+
+		cout << "batched log-densities: frames " << frames
+			 << ", max deviation " << maxDeviation
+			 << ", zero-density mismatches " << zeroMismatches << endl;
+		return 0;
+	}
+
+	/* The double precision model is the reference every reduced precision is measured against. */
+	unique_ptr<Scorer> reference = loadScorer(hmmFilename, Precision::Double);
+
+	const char* names[] = {"float", "mixed"};
+	Precision precisions[] = {Precision::Single, Precision::Mixed};
+
+	for (int p = 0; p < 2; ++p)
+	{
+		unique_ptr<Scorer> scorer = loadScorer(hmmFilename, precisions[p]);
+
+		size_t sequences = 0, pathMismatches = 0, zeroMismatches = 0;
+		double maxDeviation = 0;
+
+		for (auto i = obsFilenames.begin(); i != obsFilenames.end(); ++i)
+		{
+			for (auto obs : parseObsFile(*i))
+			{
+				++sequences;
+
+				double expected = reference->logLikelihood(obs);
+				double actual = scorer->logLikelihood(obs);
+
+				/* A sequence must be impossible under both models or under neither. */
+				if (isinf(expected) || isinf(actual))
+				{
+					if (isinf(expected) != isinf(actual))
+						++zeroMismatches;
+				}
+				else
+					maxDeviation = max(maxDeviation, fabs(actual - expected));
+
+				if (reference->viterbi(obs).second != scorer->viterbi(obs).second)
+					++pathMismatches;
+			}
+		}
+
+		cout << names[p] << ": sequences " << sequences
+			 << ", max log-likelihood deviation " << maxDeviation
+			 << ", zero-probability mismatches " << zeroMismatches
+			 << ", viterbi path mismatches " << pathMismatches << endl;
+	}
+
+	/* The parallel-in-time passes reassociate the same products, so they should agree with the
+	 * sequential ones up to rounding whatever the thread count. */
+	HiddenMarkovModel hmm(hmmFilename);
+	DenseModel<double> model(hmm);
+	const unsigned threads = 4;
+
+	size_t sequences = 0, pathMismatches = 0;
+	double maxDeviation = 0, maxPathDeviation = 0;
+
+	for (auto i = obsFilenames.begin(); i != obsFilenames.end(); ++i)
+	{
+		for (auto obs : parseObsFile(*i))
+		{
+			++sequences;
+			vector<int> seq = model.encode(obs);
+
+			double expected = reference->logLikelihood(obs);
+			double actual = model.parallelLogLikelihood(seq, threads);
+			if (!isinf(expected) || !isinf(actual))
+				maxDeviation = max(maxDeviation, fabs(actual - expected));
+
+			pair<double, vector<string> > best = reference->viterbi(obs);
+			pair<double, vector<int> > parallel = model.parallelViterbi(seq, threads);
+			if (!isinf(best.first) || !isinf(parallel.first))
+				maxPathDeviation = max(maxPathDeviation, fabs(parallel.first - best.first));
+
+			vector<string> path;
+			for (auto stt : parallel.second)
+				path.push_back(model.states()[stt]);
+			if (path != best.second)
+				++pathMismatches;
+		}
+	}
+
+	cout << "parallel scan (" << threads << " threads): sequences " << sequences
+		 << ", max log-likelihood deviation " << maxDeviation
+		 << ", max viterbi score deviation " << maxPathDeviation
+		 << ", viterbi path mismatches " << pathMismatches << endl;
+
+	/* The chunk matrices must keep rows whose paths differ by more than the range of a double:
+	 * in this left-right model, a chunk of a's entered in R scores 0.1 a step against 0.9 when
+	 * entered in L, yet after the run of b's every likely path is in R. */
+	{
+		DenseModel<double> leftRight({"L", "R"}, {"a", "b"}, {0.5, 0.5, 0, 1},
+									 {0.9, 0.1, 0.1, 0.9}, {1, 0});
+		vector<int> seq(20000, 1);
+		fill(seq.begin() + 10000, seq.end(), 0);
+
+		double expected = leftRight.logLikelihood(seq);
+		double actual = leftRight.parallelLogLikelihood(seq, threads);
+		pair<double, vector<int> > best = leftRight.viterbi(seq);
+		pair<double, vector<int> > parallel = leftRight.parallelViterbi(seq, threads);
+
+		cout << "parallel scan, left-right model: log-likelihood deviation "
+			 << fabs(actual - expected) << ", viterbi score deviation "
+			 << fabs(parallel.first - best.first) << ", viterbi path "
+			 << (parallel.second == best.second ? "matches" : "differs") << endl;
+	}
+
+	/* So should the tiled lock step passes, with small tiles to exercise the tile edges. */
+	vector<vector<int> > batch;
+	for (auto i = obsFilenames.begin(); i != obsFilenames.end(); ++i)
+		for (auto obs : parseObsFile(*i))
+			batch.push_back(model.encode(obs));
+
+	BatchOptions options;
+	options.threads = 2;
+	options.tile = 16;
+
+	vector<double> likelihoods = model.batchLogLikelihood(batch, options);
+	vector<pair<double, vector<int> > > paths = model.batchViterbi(batch, options);
+
+	maxDeviation = maxPathDeviation = 0;
+	pathMismatches = 0;
+
+	for (size_t k = 0; k < batch.size(); ++k)
+	{
+		double expected = model.logLikelihood(batch[k]);
+		if (!isinf(expected) || !isinf(likelihoods[k]))
+			maxDeviation = max(maxDeviation, fabs(likelihoods[k] - expected));
+
+		pair<double, vector<int> > best = model.viterbi(batch[k]);
+		if (!isinf(best.first) || !isinf(paths[k].first))
+			maxPathDeviation = max(maxPathDeviation, fabs(paths[k].first - best.first));
+		if (paths[k].second != best.second)
+			++pathMismatches;
+	}
+
+	cout << "tiled batch (" << options.threads << " threads): sequences " << batch.size()
+		 << ", max log-likelihood deviation " << maxDeviation
+		 << ", max viterbi score deviation " << maxPathDeviation
+		 << ", viterbi path mismatches " << pathMismatches << endl;
+
+	/* Fusing A with the emissions of the hot outputs only regroups the products of each step. */
+	DenseModel<double> fused(hmm);
+	size_t fusedOutputs = fused.fuseHotOutputs(batch, size_t(16) << 20);
+
+	maxDeviation = maxPathDeviation = 0;
+	pathMismatches = 0;
+	double maxCountDeviation = 0;
+
+	for (auto& seq : batch)
+	{
+		double expected = model.logLikelihood(seq), actual = fused.logLikelihood(seq);
+		if (!isinf(expected) || !isinf(actual))
+			maxDeviation = max(maxDeviation, fabs(actual - expected));
+
+		pair<double, vector<int> > best = model.viterbi(seq), fusedBest = fused.viterbi(seq);
+		if (!isinf(best.first) || !isinf(fusedBest.first))
+			maxPathDeviation = max(maxPathDeviation, fabs(fusedBest.first - best.first));
+		if (fusedBest.second != best.second)
+			++pathMismatches;
+
+		ExpectedCounts counts(model.numStates(), model.numOutputs());
+		ExpectedCounts fusedCounts(model.numStates(), model.numOutputs());
+		model.accumulate(seq, counts);
+		fused.accumulate(seq, fusedCounts);
+
+		for (size_t k = 0; k < counts.transitions.size(); ++k)
+			maxCountDeviation = max(maxCountDeviation,
+									fabs(counts.transitions[k] - fusedCounts.transitions[k]));
+	}
+
+	cout << "fused outputs (" << fusedOutputs << " of " << model.numOutputs() << "): sequences "
+		 << batch.size() << ", max log-likelihood deviation " << maxDeviation
+		 << ", max viterbi score deviation " << maxPathDeviation
+		 << ", viterbi path mismatches " << pathMismatches
+		 << ", max transition count deviation " << maxCountDeviation << endl;
+
+	/* Checkpointed forward-backward recomputes the very same alpha columns, so under a budget
+	 * just large enough for it the counts should equal those of the full trellis. A column takes
+	 * N reals and one scale. */
+	DenseModel<double> budgeted(hmm);
+	size_t columnBytes = model.numStates()*sizeof(double) + sizeof(double), checkpointed = 0;
+	maxCountDeviation = 0;
+
+	for (auto& seq : batch)
+	{
+		size_t T = seq.size(), stride = ceil(sqrt(double(T)));
+		size_t budget = ((T + stride - 1) / stride + stride) * columnBytes;
+		if (budget >= T*columnBytes)
+			continue;
+
+		++checkpointed;
+		budgeted.setMemoryBudget(budget);
+
+		ExpectedCounts counts(model.numStates(), model.numOutputs());
+		ExpectedCounts budgetedCounts(model.numStates(), model.numOutputs());
+		model.accumulate(seq, counts);
+		budgeted.accumulate(seq, budgetedCounts);
+
+		const vector<double>* expected[] = {&counts.transitions, &counts.emissions,
+											&counts.initStates};
+		const vector<double>* actual[] = {&budgetedCounts.transitions, &budgetedCounts.emissions,
+										  &budgetedCounts.initStates};
+		for (int m = 0; m < 3; ++m)
+			for (size_t k = 0; k < expected[m]->size(); ++k)
+				maxCountDeviation = max(maxCountDeviation,
+										fabs((*actual[m])[k] - (*expected[m])[k]));
+
+		if (!isinf(counts.logLikelihood) || !isinf(budgetedCounts.logLikelihood))
+			maxCountDeviation = max(maxCountDeviation,
+									fabs(budgetedCounts.logLikelihood - counts.logLikelihood));
+	}
+
+	cout << "checkpointed e-step: sequences " << checkpointed
+		 << ", max count deviation " << maxCountDeviation << endl;
+
+	return 0;
+}
+
+
+void help(char* program)
+{
+	cout << program << ": [model.hmm] [observation.obs ...]" << endl;
+	cout << program << ": [continuous_model.hmm] [features.feat ...]" << endl;
+}